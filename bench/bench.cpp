@@ -0,0 +1,551 @@
+/**
+ * hscpp_bench - throughput, compile time and memory of hscpp, printed as JSON.
+ *
+ * Every corpus and rule set is generated from a seed, so two runs with the same options scan the same
+ * data with the same rules and can be compared across releases.
+ *
+ * usage: hscpp_bench [--rules 10,1000,100000] [--threads 1,2,4,8] [--shards 1,4] [--corpus-mb 16]
+ *                    [--corpus FILE] [--seed 42] [--min-time 0.5] [--out FILE]
+ */
+#include "hs_matcher.h"
+#include "hs_stream.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct Options
+    {
+        std::vector<size_t> rules;
+        std::vector<uint32_t> threads;
+        std::vector<uint32_t> shards;
+        size_t corpus_mb;
+        std::string corpus_file;
+        uint64_t seed;
+        double min_time;
+        std::string out;
+    };
+
+    /**
+     * xorshift64*, small and the same on every platform.
+     */
+    class Rng
+    {
+    public:
+        Rng(uint64_t seed) : state(seed ? seed : 1) {}
+        uint64_t Next()
+        {
+            state ^= state >> 12;
+            state ^= state << 25;
+            state ^= state >> 27;
+            return state * 2685821657736338717ull;
+        }
+        size_t Below(size_t n) { return static_cast<size_t>(Next() % n); }
+
+    private:
+        uint64_t state;
+    };
+
+    std::string Word(Rng &rng, size_t len)
+    {
+        std::string word(len, 'a');
+        for (auto &&c : word)
+        {
+            c = static_cast<char>('a' + rng.Below(26));
+        }
+        return word;
+    }
+
+    struct Rule
+    {
+        std::string expr;
+        uint32_t flag;
+        // a string the rule matches, planted in the synthetic corpus.
+        std::string sample;
+    };
+
+    /**
+     * mostly literals, with some classes, bounded repeats and caseless rules like real signature sets.
+     */
+    std::vector<Rule> MakeRules(size_t count, uint64_t seed)
+    {
+        Rng rng(seed);
+        std::vector<Rule> rules;
+        for (size_t i = 0; i < count; i++)
+        {
+            switch (i % 20)
+            {
+            case 16:
+            case 17:
+            {
+                auto head = Word(rng, 4), tail = Word(rng, 4);
+                rules.push_back(Rule{head + "[0-9]{2,4}" + tail, 0, head + "123" + tail});
+                break;
+            }
+            case 18:
+            {
+                auto head = Word(rng, 4), tail = Word(rng, 4);
+                rules.push_back(Rule{head + ".{0,8}" + tail, HS_FLAG_DOTALL, head + "xyz" + tail});
+                break;
+            }
+            case 19:
+            {
+                auto word = Word(rng, 7);
+                rules.push_back(Rule{word, HS_FLAG_CASELESS, word});
+                break;
+            }
+            default:
+            {
+                auto word = Word(rng, 8 + rng.Below(5));
+                rules.push_back(Rule{word, 0, word});
+                break;
+            }
+            }
+        }
+        return rules;
+    }
+
+    /**
+     * random words and spaces, with a sample of a random rule about every 4KB.
+     */
+    std::string MakeCorpus(size_t size, const std::vector<Rule> &rules, uint64_t seed)
+    {
+        Rng rng(seed ^ 0x9E3779B97F4A7C15ull);
+        std::string corpus;
+        corpus.reserve(size + 64);
+        while (corpus.size() < size)
+        {
+            if (!rules.empty() && rng.Below(512) == 0)
+            {
+                corpus += rules[rng.Below(rules.size())].sample;
+            }
+            else
+            {
+                corpus += Word(rng, 2 + rng.Below(8));
+            }
+            corpus += ' ';
+        }
+        corpus.resize(size);
+        return corpus;
+    }
+
+    bool ReadFile(const std::string &path, std::string &data)
+    {
+        std::ifstream in(path, std::ios::binary);
+        if (!in)
+        {
+            return false;
+        }
+        std::ostringstream buf;
+        buf << in.rdbuf();
+        data = buf.str();
+        return true;
+    }
+
+    double Seconds(Clock::time_point start)
+    {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    /**
+     * run the scan until min_time passes, and return the throughput in MB/s.
+     */
+    template <typename F>
+    double Throughput(size_t bytes, double min_time, F &&scan)
+    {
+        // one warm-up pass, so the scratch and the caches are ready.
+        scan();
+        size_t rounds = 0;
+        auto start = Clock::now();
+        double elapsed;
+        do
+        {
+            scan();
+            rounds++;
+        } while ((elapsed = Seconds(start)) < min_time);
+        return static_cast<double>(bytes) * rounds / elapsed / (1024.0 * 1024.0);
+    }
+
+    /**
+     * threads started once that run the same job in rounds, so that a timed round is only the scans and
+     * not creating and joining threads.
+     */
+    class RoundPool
+    {
+    public:
+        RoundPool(uint32_t threads, std::function<void()> ujob)
+            : job(ujob), round(0), running(0), stop(false)
+        {
+            for (uint32_t t = 0; t < threads; t++)
+            {
+                workers.emplace_back(&RoundPool::Loop, this);
+            }
+        }
+
+        ~RoundPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                stop = true;
+            }
+            start_cv.notify_all();
+            for (auto &&th : workers)
+            {
+                th.join();
+            }
+        }
+
+        /**
+         * run the job once on every thread, and wait until all are done.
+         */
+        void Run()
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            running = static_cast<uint32_t>(workers.size());
+            round++;
+            start_cv.notify_all();
+            done_cv.wait(lock, [this]
+                         { return !running; });
+        }
+
+    private:
+        void Loop()
+        {
+            uint64_t seen = 0;
+            std::unique_lock<std::mutex> lock(mtx);
+            while (true)
+            {
+                start_cv.wait(lock, [&]
+                              { return stop || round != seen; });
+                if (stop)
+                {
+                    return;
+                }
+                seen = round;
+                lock.unlock();
+                job();
+                lock.lock();
+                if (!--running)
+                {
+                    done_cv.notify_one();
+                }
+            }
+        }
+
+        std::function<void()> job;
+        std::mutex mtx;
+        std::condition_variable start_cv;
+        std::condition_variable done_cv;
+        uint64_t round;
+        uint32_t running;
+        bool stop;
+        std::vector<std::thread> workers;
+    };
+
+    /**
+     * a tiny JSON writer, just enough for flat objects and arrays.
+     */
+    class Json
+    {
+    public:
+        void Open(const char *key, char bracket)
+        {
+            Key(key);
+            out << bracket;
+            first = true;
+        }
+        void Close(char bracket)
+        {
+            out << bracket;
+            first = false;
+        }
+        void Field(const char *key, double value)
+        {
+            Key(key);
+            out << value;
+        }
+        void Field(const char *key, uint64_t value)
+        {
+            Key(key);
+            out << value;
+        }
+        void Field(const char *key, const std::string &value)
+        {
+            Key(key);
+            out << '"';
+            for (auto &&c : value)
+            {
+                if (c == '"' || c == '\\')
+                {
+                    out << '\\';
+                }
+                out << c;
+            }
+            out << '"';
+        }
+        std::string Str() const { return out.str(); }
+
+    private:
+        void Key(const char *key)
+        {
+            if (!first)
+            {
+                out << ',';
+            }
+            first = false;
+            if (key)
+            {
+                out << '"' << key << "\":";
+            }
+        }
+        std::ostringstream out;
+        bool first = true;
+    };
+
+    constexpr size_t BLOCK_SIZE = 64 * 1024;
+    constexpr size_t STREAM_WRITE = 4 * 1024;
+    constexpr size_t VECTOR_BLOCKS = 16;
+
+    int DropHit(unsigned int, unsigned long long, unsigned long long, const Echidna::UserCtx *, const Echidna::UserCtx *)
+    {
+        return 0;
+    }
+
+    void Load(Echidna::HsMatcher &matcher, const std::vector<Rule> &rules)
+    {
+        for (auto &&rule : rules)
+        {
+            Echidna::Hs_Pattern pat(rule.expr, AUTOID, rule.flag);
+            matcher.push_back(pat);
+        }
+    }
+
+    void BenchRules(Json &json, const Options &opts, size_t count)
+    {
+        auto rules = MakeRules(count, opts.seed + count);
+        std::string corpus;
+        if (opts.corpus_file.empty())
+        {
+            corpus = MakeCorpus(opts.corpus_mb * 1024 * 1024, rules, opts.seed);
+        }
+        else if (!ReadFile(opts.corpus_file, corpus))
+        {
+            fprintf(stderr, "cannot read corpus %s\n", opts.corpus_file.c_str());
+            exit(1);
+        }
+
+        std::vector<Echidna::DataBlock> blocks;
+        for (size_t pos = 0; pos < corpus.size(); pos += BLOCK_SIZE)
+        {
+            blocks.push_back(Echidna::DataBlock(corpus.data() + pos, std::min(BLOCK_SIZE, corpus.size() - pos)));
+        }
+
+        json.Open(nullptr, '{');
+        json.Field("rules", static_cast<uint64_t>(count));
+        json.Field("corpus_bytes", static_cast<uint64_t>(corpus.size()));
+
+        // block mode: compile, memory, Match and SafeMatch scaling.
+        Echidna::HsMatcher block;
+        block.RegisteCb(DropHit);
+        Load(block, rules);
+        // adding patterns starts a background compile, it must not run on the same cores as the timed one.
+        block.Sync();
+        auto start = Clock::now();
+        int ret = block.compile();
+        json.Field("compile_seconds", Seconds(start));
+        if (ret != HS_SUCCESS)
+        {
+            json.Field("error", std::string("compile failed"));
+            json.Close('}');
+            return;
+        }
+        json.Field("database_bytes", static_cast<uint64_t>(block.DatabaseSize()));
+        json.Field("scratch_bytes", static_cast<uint64_t>(block.ScratchSize()));
+
+        auto match = [&]
+        {
+            for (auto &&b : blocks)
+            {
+                block.Match(b, DropHit);
+            }
+        };
+        json.Field("block_match_mbps", Throughput(corpus.size(), opts.min_time, match));
+
+        json.Open("block_safe_match_mbps", '{');
+        for (auto &&threads : opts.threads)
+        {
+            RoundPool pool(threads, [&]
+                           {
+                for (auto &&b : blocks)
+                {
+                    block.SafeMatch(b, DropHit);
+                } });
+            double mbps = Throughput(corpus.size() * threads, opts.min_time, [&]
+                                     { pool.Run(); });
+            json.Field(std::to_string(threads).c_str(), mbps);
+        }
+        json.Close('}');
+
+        // shards: compile time against scan throughput, see HsMatcher::SetShards().
+        json.Open("shards", '{');
+        for (auto &&shards : opts.shards)
+        {
+            block.SetShards(shards);
+            block.Sync();
+            start = Clock::now();
+            ret = block.compile();
+            double seconds = Seconds(start);
+            json.Open(std::to_string(shards).c_str(), '{');
+            if (ret != HS_SUCCESS)
+            {
+                json.Field("error", std::string("compile failed"));
+            }
+            else
+            {
+                json.Field("shard_count", static_cast<uint64_t>(block.ShardCount()));
+                json.Field("compile_seconds", seconds);
+                json.Field("block_match_mbps", Throughput(corpus.size(), opts.min_time, match));
+            }
+            json.Close('}');
+        }
+        json.Close('}');
+
+        // vectored mode: blocks of the corpus scanned as one piece of data.
+        Echidna::HsMatcher vectored;
+        vectored.RegisteCb(DropHit);
+        Load(vectored, rules);
+        vectored.SetMode(Echidna::HsMatcher::MatchMode::vector);
+        vectored.Sync();
+        json.Field("vector_match_mbps", Throughput(corpus.size(), opts.min_time, [&]
+                                                   {
+            for (size_t i = 0; i < blocks.size(); i += VECTOR_BLOCKS)
+            {
+                vectored.Match(blocks.data() + i, std::min(VECTOR_BLOCKS, blocks.size() - i), DropHit);
+            } }));
+
+        // stream mode: the corpus written in small chunks, like packets of one flow.
+        Echidna::HsMatcher streaming;
+        streaming.RegisteCb(DropHit);
+        Load(streaming, rules);
+        streaming.SetMode(Echidna::HsMatcher::MatchMode::stream);
+        streaming.Sync();
+        json.Field("stream_state_bytes", static_cast<uint64_t>(streaming.StreamSize()));
+        json.Field("stream_write_mbps", Throughput(corpus.size(), opts.min_time, [&]
+                                                   {
+            Echidna::HsStream stream(streaming, DropHit);
+            stream.Open();
+            for (size_t pos = 0; pos < corpus.size(); pos += STREAM_WRITE)
+            {
+                stream.Write(corpus.data() + pos, std::min(STREAM_WRITE, corpus.size() - pos));
+            }
+            stream.Close(); }));
+
+        json.Close('}');
+    }
+
+    template <typename T>
+    std::vector<T> ParseList(const char *arg)
+    {
+        std::vector<T> list;
+        std::stringstream in(arg);
+        std::string item;
+        while (std::getline(in, item, ','))
+        {
+            list.push_back(static_cast<T>(strtoull(item.c_str(), nullptr, 10)));
+        }
+        return list;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Options opts;
+    opts.rules = {10, 1000, 100000};
+    opts.shards = {1, 4};
+    opts.corpus_mb = 16;
+    opts.seed = 42;
+    opts.min_time = 0.5;
+    uint32_t cores = std::thread::hardware_concurrency();
+    for (uint32_t t = 1; t <= (cores ? cores : 1); t *= 2)
+    {
+        opts.threads.push_back(t);
+    }
+
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string key(argv[i]);
+        if (key == "--rules")
+        {
+            opts.rules = ParseList<size_t>(argv[i + 1]);
+        }
+        else if (key == "--threads")
+        {
+            opts.threads = ParseList<uint32_t>(argv[i + 1]);
+        }
+        else if (key == "--shards")
+        {
+            opts.shards = ParseList<uint32_t>(argv[i + 1]);
+        }
+        else if (key == "--corpus-mb")
+        {
+            opts.corpus_mb = strtoull(argv[i + 1], nullptr, 10);
+        }
+        else if (key == "--corpus")
+        {
+            opts.corpus_file = argv[i + 1];
+        }
+        else if (key == "--seed")
+        {
+            opts.seed = strtoull(argv[i + 1], nullptr, 10);
+        }
+        else if (key == "--min-time")
+        {
+            opts.min_time = atof(argv[i + 1]);
+        }
+        else if (key == "--out")
+        {
+            opts.out = argv[i + 1];
+        }
+        else
+        {
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    Json json;
+    json.Open(nullptr, '{');
+    json.Field("hyperscan", std::string(hs_version()));
+    json.Field("seed", opts.seed);
+    json.Field("corpus", opts.corpus_file.empty() ? std::string("synthetic") : opts.corpus_file);
+    json.Open("results", '[');
+    for (auto &&count : opts.rules)
+    {
+        BenchRules(json, opts, count);
+    }
+    json.Close(']');
+    json.Close('}');
+
+    if (opts.out.empty())
+    {
+        printf("%s\n", json.Str().c_str());
+    }
+    else
+    {
+        std::ofstream out(opts.out);
+        out << json.Str() << "\n";
+    }
+    return 0;
+}
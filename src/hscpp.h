@@ -1,2 +1,5 @@
 #pragma once
-#include "hs_matcher.h"
\ No newline at end of file
+#include "hs_matcher.h"
+#include "hs_stream.h"
+#include "hs_flow_table.h"
+#include "hs_scan_engine.h"
\ No newline at end of file
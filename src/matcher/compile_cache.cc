@@ -0,0 +1,157 @@
+#include "compile_cache.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "debug_log.h"
+
+namespace Echidna
+{
+    std::string CacheKey::Hex() const
+    {
+        char buf[33];
+        snprintf(buf, sizeof(buf), "%016llx%016llx", static_cast<unsigned long long>(hi), static_cast<unsigned long long>(lo));
+        return buf;
+    }
+
+    CacheKeyBuilder::CacheKeyBuilder()
+    {
+        // two independent 64-bit FNV-1a lanes with different offset bases.
+        key.lo = 0xcbf29ce484222325ULL;
+        key.hi = 0x84222325cbf29ce4ULL;
+    }
+
+    void CacheKeyBuilder::Add(const void *data, size_t len)
+    {
+        const unsigned char *p = static_cast<const unsigned char *>(data);
+        for (size_t i = 0; i < len; i++)
+        {
+            key.lo = (key.lo ^ p[i]) * 0x100000001b3ULL;
+            key.hi = (key.hi ^ (p[i] + 0x9d)) * 0x100000001b3ULL;
+            key.hi ^= key.hi >> 29;
+        }
+    }
+
+    void CacheKeyBuilder::Add(const std::string &value)
+    {
+        uint64_t len = value.size();
+        Add(len);
+        Add(value.data(), value.size());
+    }
+
+    CompileCache::CompileCache(size_t max_entries, const std::string &udir)
+        : capacity(max_entries),
+          dir(udir),
+          hits(0),
+          misses(0)
+    {
+        if (!dir.empty())
+        {
+            mkdir(dir.c_str(), 0755);
+        }
+    }
+
+    std::string CompileCache::Path(const CacheKey &key) const
+    {
+        return dir + "/" + key.Hex() + ".hsdb";
+    }
+
+    void CompileCache::Remember(const CacheKey &key, std::string &&bytes)
+    {
+        // called with mtx held.
+        if (!capacity)
+        {
+            return;
+        }
+        auto it = entries.find(key);
+        if (it != entries.end())
+        {
+            lru.erase(it->second.second);
+            entries.erase(it);
+        }
+        lru.push_front(key);
+        entries[key] = Entry(std::move(bytes), lru.begin());
+        while (entries.size() > capacity)
+        {
+            entries.erase(lru.back());
+            lru.pop_back();
+        }
+    }
+
+    bool CompileCache::Get(const CacheKey &key, std::string &bytes)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            auto it = entries.find(key);
+            if (it != entries.end())
+            {
+                lru.splice(lru.begin(), lru, it->second.second);
+                bytes = it->second.first;
+                hits.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+
+        if (!dir.empty())
+        {
+            int fd = open(Path(key).c_str(), O_RDONLY);
+            if (fd >= 0)
+            {
+                struct stat st;
+                bool ok = fstat(fd, &st) == 0;
+                if (ok)
+                {
+                    bytes.resize(st.st_size);
+                    size_t done = 0;
+                    while (ok && done < bytes.size())
+                    {
+                        ssize_t n = read(fd, &bytes[done], bytes.size() - done);
+                        ok = n > 0;
+                        done += ok ? n : 0;
+                    }
+                }
+                close(fd);
+                if (ok)
+                {
+                    std::lock_guard<std::mutex> lock(mtx);
+                    std::string copy(bytes);
+                    Remember(key, std::move(copy));
+                    hits.fetch_add(1, std::memory_order_relaxed);
+                    return true;
+                }
+            }
+        }
+
+        misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    void CompileCache::Put(const CacheKey &key, const char *bytes, size_t len)
+    {
+        if (!dir.empty())
+        {
+            std::string path = Path(key);
+            // a unique name per writer, threads of one process share the pid.
+            std::string tmp = path + ".tmpXXXXXX";
+            int fd = mkstemp(&tmp[0]);
+            if (fd < 0)
+            {
+                HSCPP_DLOG(Warning, "cannot create compile cache file %s", tmp.c_str());
+            }
+            else
+            {
+                bool ok = fchmod(fd, 0644) == 0 && write(fd, bytes, len) == static_cast<ssize_t>(len);
+                ok = (close(fd) == 0) && ok;
+                if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+                {
+                    HSCPP_DLOG(Warning, "cannot write compile cache file %s", path.c_str());
+                    unlink(tmp.c_str());
+                }
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mtx);
+        Remember(key, std::string(bytes, len));
+    }
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <string>
+#include <atomic>
+#include <list>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <stdint.h>
+
+namespace Echidna
+{
+    /**
+     * the content hash of one compiled bucket of patterns, generally users don't need to care it.
+     */
+    struct CacheKey
+    {
+        uint64_t lo;
+        uint64_t hi;
+        bool operator<(const CacheKey &other) const
+        {
+            return hi < other.hi || (hi == other.hi && lo < other.lo);
+        }
+        std::string Hex() const;
+    };
+
+    /**
+     * it builds a @ref CacheKey from everything a compiled database depends on.
+     */
+    class CacheKeyBuilder
+    {
+    public:
+        CacheKeyBuilder();
+        void Add(const void *data, size_t len);
+        template <typename T>
+        void Add(const T &value) { Add(&value, sizeof(value)); }
+        void Add(const std::string &value);
+        CacheKey Key() const { return key; }
+
+    private:
+        CacheKey key;
+    };
+
+    /**
+     * it keeps serialized compiled databases by the content hash of their patterns, so an unchanged bucket
+     * is deserialized instead of compiled again. Entries live in memory with LRU eviction, and optionally in
+     * a directory that is shared by restarts and processes. It is thread safe.
+     */
+    class CompileCache
+    {
+    public:
+        /**
+         * @param max_entries
+         *      the maximum number of databases kept in memory.
+         * @param dir
+         *      the directory to keep databases in as well, or empty to keep them in memory only.
+         */
+        CompileCache(size_t max_entries, const std::string &dir = "");
+
+        bool Get(const CacheKey &key, std::string &bytes);
+        void Put(const CacheKey &key, const char *bytes, size_t len);
+
+        uint64_t Hits() const { return hits.load(std::memory_order_relaxed); }
+        uint64_t Misses() const { return misses.load(std::memory_order_relaxed); }
+
+    private:
+        using Entry = std::pair<std::string, std::list<CacheKey>::iterator>;
+
+        std::string Path(const CacheKey &key) const;
+        void Remember(const CacheKey &key, std::string &&bytes);
+
+        size_t capacity;
+        std::string dir;
+        std::mutex mtx;
+        std::map<CacheKey, Entry> entries;
+        // most recently used first.
+        std::list<CacheKey> lru;
+        std::atomic<uint64_t> hits;
+        std::atomic<uint64_t> misses;
+    };
+
+    using CompileCachePtr = std::shared_ptr<CompileCache>;
+}
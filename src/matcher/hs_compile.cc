@@ -0,0 +1,644 @@
+#include "hs_matcher.h"
+#include <algorithm>
+#include <map>
+#include <thread>
+#include <ctype.h>
+#include <stdlib.h>
+#include "debug_log.h"
+
+// hs_compile_lit_multi() came with hyperscan 5.2, older versions compile literals as escaped regex.
+#if HS_MAJOR > 5 || (HS_MAJOR == 5 && HS_MINOR >= 2)
+#define HSCPP_LITERAL_DB 1
+#else
+#define HSCPP_LITERAL_DB 0
+#endif
+
+namespace Echidna
+{
+    namespace
+    {
+        // the only flags a literal database takes, dotall and multiline don't matter without regex syntax.
+        constexpr uint32_t LITERAL_FLAGS = HS_FLAG_CASELESS | HS_FLAG_SINGLEMATCH | HS_FLAG_SOM_LEFTMOST;
+        constexpr uint32_t LITERAL_IGNORED = HS_FLAG_DOTALL | HS_FLAG_MULTILINE;
+
+        /**
+         * the expressions shards are compiled from. A pattern's text is replaced by its bytes when a regex is
+         * compiled as a literal, or by an escaped regex when a literal can't be.
+         */
+        struct ShardSource
+        {
+            const std::vector<PatternRef> &refs;
+            std::vector<std::string> text;
+
+            const char *Expr(size_t i) const { return text[i].empty() ? refs[i].expr : text[i].c_str(); }
+            size_t Len(size_t i) const { return text[i].empty() ? refs[i].len : text[i].size(); }
+        };
+
+        bool LiteralFlags(const PatternRef &pat)
+        {
+            return !(pat.flag & ~(LITERAL_FLAGS | LITERAL_IGNORED)) && !(pat.ext && pat.ext->flags);
+        }
+
+        int HexDigit(unsigned char c)
+        {
+            if (c >= '0' && c <= '9')
+            {
+                return c - '0';
+            }
+            c = tolower(c);
+            return (c >= 'a' && c <= 'f') ? c - 'a' + 10 : -1;
+        }
+
+        /**
+         * the bytes a regex stands for, if it has no regex syntax: plain characters, escaped punctuation and
+         * the \xHH, \t, \n, \r, \f, \e, \a escapes.
+         */
+        bool ToLiteral(const PatternRef &pat, std::string &bytes)
+        {
+            if (!LiteralFlags(pat))
+            {
+                return false;
+            }
+            const std::string expr(pat.expr, pat.len);
+            bytes.clear();
+            for (size_t i = 0; i < expr.size(); i++)
+            {
+                unsigned char c = expr[i];
+                switch (c)
+                {
+                case '^':
+                case '$':
+                case '.':
+                case '|':
+                case '?':
+                case '*':
+                case '+':
+                case '(':
+                case ')':
+                case '[':
+                case ']':
+                case '{':
+                case '}':
+                case '\0':
+                    return false;
+                case '\\':
+                    break;
+                default:
+                    bytes.push_back(c);
+                    continue;
+                }
+
+                if (++i == expr.size())
+                {
+                    return false;
+                }
+                c = expr[i];
+                switch (c)
+                {
+                case 't':
+                    bytes.push_back('\t');
+                    break;
+                case 'n':
+                    bytes.push_back('\n');
+                    break;
+                case 'r':
+                    bytes.push_back('\r');
+                    break;
+                case 'f':
+                    bytes.push_back('\f');
+                    break;
+                case 'e':
+                    bytes.push_back('\x1b');
+                    break;
+                case 'a':
+                    bytes.push_back('\a');
+                    break;
+                case 'x':
+                {
+                    int high = i + 1 < expr.size() ? HexDigit(expr[i + 1]) : -1;
+                    int low = i + 2 < expr.size() ? HexDigit(expr[i + 2]) : -1;
+                    if (high < 0 || low < 0)
+                    {
+                        return false;
+                    }
+                    bytes.push_back(static_cast<char>(high << 4 | low));
+                    i += 2;
+                    break;
+                }
+                default:
+                    // \d, \b, \Q, back references and the like are regex syntax.
+                    if (isalnum(c) || c >= 0x80)
+                    {
+                        return false;
+                    }
+                    bytes.push_back(c);
+                    break;
+                }
+            }
+            return !bytes.empty();
+        }
+
+        /**
+         * a regex that matches the bytes of a literal. Bytes from 0x80 are kept raw, so that they mean the
+         * same with and without the utf8 flag.
+         */
+        std::string EscapeLiteral(const char *bytes, size_t len)
+        {
+            static const char hex[] = "0123456789abcdef";
+            std::string expr;
+            expr.reserve(len * 2);
+            for (size_t i = 0; i < len; i++)
+            {
+                unsigned char c = bytes[i];
+                if (isalnum(c) || c >= 0x80)
+                {
+                    expr.push_back(c);
+                }
+                else
+                {
+                    expr.append("\\x");
+                    expr.push_back(hex[c >> 4]);
+                    expr.push_back(hex[c & 0xf]);
+                }
+            }
+            return expr;
+        }
+
+        /**
+         * sort the patterns into the ones compiled as regex and the ones compiled as literals, and set the
+         * text of the ones that are not compiled as they are written.
+         *
+         * @param split
+         *      literals may get databases of their own, if not they are compiled as escaped regex.
+         */
+        void Classify(ShardSource &source, bool split, bool detect, std::vector<size_t> &regex_members, std::vector<size_t> &literal_members)
+        {
+            for (size_t i = 0; i < source.refs.size(); i++)
+            {
+                const PatternRef &pat = source.refs[i];
+                if (pat.literal)
+                {
+                    if (split && LiteralFlags(pat) && pat.len)
+                    {
+                        literal_members.push_back(i);
+                    }
+                    else
+                    {
+                        source.text[i] = EscapeLiteral(pat.expr, pat.len);
+                        regex_members.push_back(i);
+                    }
+                }
+                else if (split && detect && ToLiteral(pat, source.text[i]))
+                {
+                    literal_members.push_back(i);
+                }
+                else
+                {
+                    source.text[i].clear();
+                    regex_members.push_back(i);
+                }
+            }
+        }
+
+        /**
+         * a rough relative compile cost of one pattern, used to balance shards.
+         */
+        size_t EstimateCost(const PatternRef &pat)
+        {
+            size_t cost = pat.len + 1;
+            for (size_t i = 0; i < pat.len; i++)
+            {
+                switch (pat.expr[i])
+                {
+                case '*':
+                case '+':
+                case '{':
+                    cost += 16;
+                    break;
+                case '?':
+                case '|':
+                case '[':
+                case '.':
+                    cost += 4;
+                    break;
+                default:
+                    break;
+                }
+            }
+            if (pat.flag & HS_FLAG_CASELESS)
+            {
+                cost += cost / 2;
+            }
+            if (pat.flag & HS_FLAG_SOM_LEFTMOST)
+            {
+                cost *= 2;
+            }
+            auto ext = pat.ext;
+            if (ext && (ext->flags & (HS_EXT_FLAG_EDIT_DISTANCE | HS_EXT_FLAG_HAMMING_DISTANCE)))
+            {
+                cost *= 1 + ext->edit_distance + ext->hamming_distance;
+            }
+            return cost;
+        }
+
+        /**
+         * assign weighted items to the least loaded of the given shards, heaviest first.
+         */
+        void Balance(std::vector<std::pair<size_t, std::vector<size_t>>> &items, std::vector<std::vector<size_t>> &shards)
+        {
+            std::stable_sort(items.begin(), items.end(),
+                             [](const std::pair<size_t, std::vector<size_t>> &a, const std::pair<size_t, std::vector<size_t>> &b)
+                             { return a.first > b.first; });
+            std::vector<size_t> load(shards.size(), 0);
+            for (auto &&item : items)
+            {
+                size_t target = std::min_element(load.begin(), load.end()) - load.begin();
+                load[target] += item.first;
+                shards[target].insert(shards[target].end(), item.second.begin(), item.second.end());
+            }
+            for (auto &&shard : shards)
+            {
+                std::sort(shard.begin(), shard.end());
+            }
+        }
+
+        /**
+         * the content hash of a shard: hyperscan version, target platform, mode, kind and every pattern in order.
+         */
+        CacheKey ShardKey(const ShardSource &source, const std::vector<size_t> &members, bool literal, uint32_t mode)
+        {
+            CacheKeyBuilder builder;
+            builder.Add(std::string(hs_version()));
+            hs_platform_info_t platform;
+            if (hs_populate_platform(&platform) == HS_SUCCESS)
+            {
+                builder.Add(platform.tune);
+                builder.Add(platform.cpu_features);
+            }
+            builder.Add(mode);
+            builder.Add(static_cast<uint8_t>(literal ? 1 : 0));
+            for (auto &&i : members)
+            {
+                const PatternRef &pat = source.refs[i];
+                builder.Add(pat.id);
+                builder.Add(pat.flag);
+                builder.Add(static_cast<uint64_t>(source.Len(i)));
+                builder.Add(source.Expr(i), source.Len(i));
+                auto ext = pat.ext;
+                builder.Add(static_cast<uint8_t>(ext ? 1 : 0));
+                if (ext)
+                {
+                    builder.Add(ext->flags);
+                    builder.Add(ext->min_offset);
+                    builder.Add(ext->max_offset);
+                    builder.Add(ext->min_length);
+                    builder.Add(ext->edit_distance);
+                    builder.Add(ext->hamming_distance);
+                }
+            }
+            return builder.Key();
+        }
+
+        int CompileShard(const ShardSource &source, const std::vector<size_t> &members, bool literal, uint32_t mode, hs_database_t **db)
+        {
+            std::vector<const char *> expressions(members.size());
+            std::vector<size_t> lengths(members.size());
+            std::vector<unsigned int> pflags(members.size());
+            std::vector<unsigned int> ids(members.size());
+            std::vector<const hs_expr_ext_t *> ext(members.size());
+            for (size_t i = 0; i < members.size(); i++)
+            {
+                const PatternRef &pat = source.refs[members[i]];
+                expressions[i] = source.Expr(members[i]);
+                lengths[i] = source.Len(members[i]);
+                pflags[i] = literal ? pat.flag & LITERAL_FLAGS : pat.flag;
+                ids[i] = pat.id;
+                ext[i] = pat.ext;
+            }
+
+            hs_compile_error_t *error = nullptr;
+            hs_error_t ret = HS_INVALID;
+            if (!literal)
+            {
+                ret = hs_compile_ext_multi(expressions.data(), pflags.data(), ids.data(), ext.data(), members.size(), mode, nullptr, db, &error);
+            }
+#if HSCPP_LITERAL_DB
+            else
+            {
+                ret = hs_compile_lit_multi(expressions.data(), pflags.data(), ids.data(), lengths.data(), members.size(), mode, nullptr, db, &error);
+            }
+#endif
+            if (ret != HS_SUCCESS)
+            {
+                std::string where;
+                if (error && error->expression >= 0 && static_cast<size_t>(error->expression) < members.size())
+                {
+                    where = " at " + std::string(expressions[error->expression], lengths[error->expression]);
+                }
+                HSCPP_DLOG(Warning, "hs compile error! error no is%d -> %s%s", ret, error ? error->message : "", where.c_str());
+                *db = nullptr;
+            }
+            hs_free_compile_error(error);
+            return ret;
+        }
+
+        int CompileCachedShard(const ShardSource &source, const std::vector<size_t> &members, bool literal, uint32_t mode, const CompileCachePtr &cache, hs_database_t **db)
+        {
+            if (!cache)
+            {
+                return CompileShard(source, members, literal, mode, db);
+            }
+
+            CacheKey key = ShardKey(source, members, literal, mode);
+            std::string bytes;
+            if (cache->Get(key, bytes))
+            {
+                if (hs_deserialize_database(bytes.data(), bytes.size(), db) == HS_SUCCESS)
+                {
+                    return HS_SUCCESS;
+                }
+                HSCPP_DLOG(Warning, "bad compile cache entry %s, compile again.", key.Hex().c_str());
+            }
+
+            auto ret = CompileShard(source, members, literal, mode, db);
+            if (ret == HS_SUCCESS)
+            {
+                char *serialized = nullptr;
+                size_t length = 0;
+                if (hs_serialize_database(*db, &serialized, &length) == HS_SUCCESS)
+                {
+                    cache->Put(key, serialized, length);
+                    free(serialized);
+                }
+            }
+            return ret;
+        }
+    }
+
+    std::vector<std::vector<size_t>> HsMatcher::Partition(const std::vector<PatternRef> &refs, const std::vector<size_t> &members, const CompileOptions &opts)
+    {
+        if (members.empty())
+        {
+            return std::vector<std::vector<size_t>>();
+        }
+
+        size_t shards = std::min<size_t>(opts.shards ? opts.shards : 1, members.size());
+        bool combination = false;
+        for (auto &&i : members)
+        {
+            combination |= (refs[i].flag & HS_FLAG_COMBINATION) != 0;
+        }
+        if (combination && shards > 1)
+        {
+            HSCPP_DLOG(Notice, "logical combinations can't be split, compile one shard.");
+            shards = 1;
+        }
+
+        std::vector<std::vector<size_t>> result(shards ? shards : 1);
+        if (shards <= 1)
+        {
+            result[0] = members;
+            return result;
+        }
+
+        switch (opts.policy)
+        {
+        case (ShardPolicy::complexity):
+        {
+            std::vector<std::pair<size_t, std::vector<size_t>>> items;
+            items.reserve(members.size());
+            for (auto &&i : members)
+            {
+                items.push_back(std::make_pair(EstimateCost(refs[i]), std::vector<size_t>(1, i)));
+            }
+            Balance(items, result);
+            break;
+        }
+        case (ShardPolicy::flag):
+        {
+            std::map<uint32_t, std::vector<size_t>> groups;
+            for (auto &&i : members)
+            {
+                groups[refs[i].flag].push_back(i);
+            }
+            std::vector<std::pair<size_t, std::vector<size_t>>> items;
+            for (auto &&group : groups)
+            {
+                // a group larger than a fair share is split, so one flag class can't hold back the others.
+                size_t fair = (members.size() + shards - 1) / shards;
+                for (size_t begin = 0; begin < group.second.size(); begin += fair)
+                {
+                    size_t end = std::min(begin + fair, group.second.size());
+                    items.push_back(std::make_pair(end - begin, std::vector<size_t>(group.second.begin() + begin, group.second.begin() + end)));
+                }
+            }
+            Balance(items, result);
+            break;
+        }
+        case (ShardPolicy::stable):
+        {
+            // ids are spread by a multiplicative hash, then each shard is ordered by id so that its content
+            // doesn't depend on the order patterns were added in.
+            for (auto &&i : members)
+            {
+                uint32_t id = refs[i].id;
+                result[(static_cast<uint64_t>(id * 0x9E3779B1u) * shards) >> 32].push_back(i);
+            }
+            for (auto &&shard : result)
+            {
+                std::sort(shard.begin(), shard.end(),
+                          [&refs](size_t a, size_t b)
+                          { return refs[a].id < refs[b].id; });
+            }
+            break;
+        }
+        case (ShardPolicy::count):
+        default:
+            for (size_t s = 0; s < shards; s++)
+            {
+                size_t begin = members.size() * s / shards;
+                size_t end = members.size() * (s + 1) / shards;
+                result[s].assign(members.begin() + begin, members.begin() + end);
+            }
+            break;
+        }
+
+        result.erase(std::remove_if(result.begin(), result.end(),
+                                    [](const std::vector<size_t> &shard)
+                                    { return shard.empty(); }),
+                     result.end());
+        return result;
+    }
+
+    int HsMatcher::CompileGroup(const std::vector<PatternRef> &group, const CompileOptions &opts, std::vector<hs_database_t *> &dbs)
+    {
+        ShardSource source{group, std::vector<std::string>(group.size())};
+        std::vector<size_t> regex_members;
+        std::vector<size_t> literal_members;
+        Classify(source, HSCPP_LITERAL_DB, opts.detect_literals, regex_members, literal_members);
+
+        dbs.clear();
+        int ret = HS_SUCCESS;
+        for (int literal = 0; literal < 2 && ret == HS_SUCCESS; literal++)
+        {
+            const std::vector<size_t> &members = literal ? literal_members : regex_members;
+            if (members.empty())
+            {
+                continue;
+            }
+            hs_database_t *db = nullptr;
+            ret = CompileShard(source, members, literal != 0, opts.mode, &db);
+            if (ret == HS_SUCCESS)
+            {
+                dbs.push_back(db);
+            }
+        }
+        if (ret != HS_SUCCESS)
+        {
+            for (auto &&db : dbs)
+            {
+                hs_free_database(db);
+            }
+            dbs.clear();
+        }
+        return ret;
+    }
+
+    int HsMatcher::BuildConfirms(const std::vector<PatternRef> &refs, const CompileOptions &opts, HsDatabase &gen)
+    {
+        // slots follow the order of refs, and a duplicate id keeps the slot of its first pattern.
+        uint32_t next = 0;
+        for (auto &&pat : refs)
+        {
+            const PatternEntry *entry = gen.index.Find(pat.id);
+            if (!entry || gen.index.Slot(entry) != next)
+            {
+                continue;
+            }
+            next++;
+            bool prefilter = (pat.flag & HS_FLAG_PREFILTER) != 0;
+            if (!pat.capture && !prefilter)
+            {
+                continue;
+            }
+            // streams and vectors have no contiguous data to confirm hits against.
+            if (prefilter && (gen.mode & (HS_MODE_STREAM | HS_MODE_VECTORED)))
+            {
+                HSCPP_DLOG(Error, "prefilter pattern %u can only be confirmed in block mode! %s", pat.id, pat.expr);
+                return HS_COMPILER_ERROR;
+            }
+            std::string error;
+            auto confirm = PatternConfirm::Create(pat, opts.confirm_window, opts.confirm_pass, error);
+            if (!confirm)
+            {
+                if (prefilter && !opts.confirm_pass)
+                {
+                    HSCPP_DLOG(Error, "regex compile error, prefilter pattern %u can't be confirmed! %s -> %s", pat.id, error.c_str(), pat.expr);
+                    return HS_COMPILER_ERROR;
+                }
+                HSCPP_DLOG(Warning, "regex compile error, hits of pattern %u are not confirmed! %s -> %s", pat.id, error.c_str(), pat.expr);
+                continue;
+            }
+            gen.index.SetConfirm(gen.index.Slot(entry), confirm.get());
+            gen.confirms.push_back(std::move(confirm));
+        }
+        return HS_SUCCESS;
+    }
+
+    int HsMatcher::Build(const std::vector<PatPtr> &snapshot, const std::vector<PatternStorePtr> &stores, const CompileOptions &opts, HsDatabasePtr &gen)
+    {
+        std::vector<PatternRef> refs;
+        CollectRefs(snapshot, stores, refs);
+        if (refs.empty())
+        {
+            HSCPP_DLOG(Notice, "The matcher is empty!");
+            return HS_INVALID;
+        }
+
+        // literals get databases of their own, unless a combination may refer to them.
+        bool split = HSCPP_LITERAL_DB;
+        for (auto &&i : refs)
+        {
+            if (i.flag & HS_FLAG_COMBINATION)
+            {
+                split = false;
+                break;
+            }
+        }
+
+        ShardSource source{refs, std::vector<std::string>(refs.size())};
+        std::vector<size_t> regex_members;
+        std::vector<size_t> literal_members;
+        Classify(source, split, opts.detect_literals, regex_members, literal_members);
+
+        auto shards = Partition(refs, regex_members, opts);
+        size_t regex_shards = shards.size();
+        auto literal_shards = Partition(refs, literal_members, opts);
+        shards.insert(shards.end(), literal_shards.begin(), literal_shards.end());
+        std::vector<hs_database_t *> dbs(shards.size(), nullptr);
+        std::vector<int> results(shards.size(), HS_SUCCESS);
+
+        if (shards.size() == 1)
+        {
+            results[0] = CompileCachedShard(source, shards[0], regex_shards == 0, opts.mode, opts.cache, &dbs[0]);
+        }
+        else
+        {
+            // a small pool of workers takes shards one by one until all are compiled.
+            std::atomic<size_t> next(0);
+            auto work = [&]()
+            {
+                for (size_t s = next++; s < shards.size(); s = next++)
+                {
+                    results[s] = CompileCachedShard(source, shards[s], s >= regex_shards, opts.mode, opts.cache, &dbs[s]);
+                }
+            };
+            size_t workers = std::min<size_t>(shards.size(), std::max(1u, std::thread::hardware_concurrency()));
+            std::vector<std::thread> pool;
+            for (size_t i = 1; i < workers; i++)
+            {
+                pool.emplace_back(work);
+            }
+            work();
+            for (auto &&t : pool)
+            {
+                t.join();
+            }
+        }
+
+        int ret = HS_SUCCESS;
+        for (auto &&r : results)
+        {
+            if (r != HS_SUCCESS)
+            {
+                ret = r;
+            }
+        }
+        if (ret != HS_SUCCESS)
+        {
+            for (auto &&db : dbs)
+            {
+                if (db)
+                {
+                    hs_free_database(db);
+                }
+            }
+            return ret;
+        }
+
+        gen = std::make_shared<HsDatabase>();
+        gen->dbs = dbs;
+        gen->mode = opts.mode;
+        gen->patterns = snapshot;
+        gen->stores = stores;
+        gen->index.Build(refs);
+        ret = BuildConfirms(refs, opts, *gen);
+        if (ret != HS_SUCCESS)
+        {
+            gen.reset();
+            return ret;
+        }
+        gen->scratch.reset(new Scratch(dbs));
+        return ret;
+    }
+}
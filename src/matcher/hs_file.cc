@@ -0,0 +1,270 @@
+#include "hs_matcher.h"
+#include <limits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include "debug_log.h"
+
+namespace Echidna
+{
+    namespace
+    {
+        /**
+         * collect the regular files under dir, without following symbolic links.
+         */
+        void ListTree(const std::string &dir, std::vector<std::string> &files)
+        {
+            DIR *handle = opendir(dir.c_str());
+            if (!handle)
+            {
+                HSCPP_DLOG(Error, "open directory %s failed! %s", dir.c_str(), strerror(errno));
+                return;
+            }
+            while (struct dirent *entry = readdir(handle))
+            {
+                if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+                {
+                    continue;
+                }
+                std::string path = dir + "/" + entry->d_name;
+                struct stat st;
+                if (lstat(path.c_str(), &st))
+                {
+                    continue;
+                }
+                if (S_ISDIR(st.st_mode))
+                {
+                    ListTree(path, files);
+                }
+                else if (S_ISREG(st.st_mode))
+                {
+                    files.push_back(path);
+                }
+            }
+            closedir(handle);
+        }
+    }
+
+    void HsMatcher::SetFileWindow(size_t threshold, size_t window)
+    {
+        size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        // a window must fit the 32-bit length hyperscan takes.
+        size_t limit = std::numeric_limits<unsigned int>::max() / page * page;
+        window = window ? (window + page - 1) / page * page : page;
+        file_threshold = threshold;
+        file_window = window < limit ? window : limit;
+    }
+
+    int HsMatcher::ScanFile(const std::string &path, MatchCb &handler, UserCtx *ctx)
+    {
+        auto gen = Acquire();
+        if (!gen)
+        {
+            return HS_INVALID;
+        }
+
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            HSCPP_DLOG(Error, "open %s failed! %s", path.c_str(), strerror(errno));
+            return HS_INVALID;
+        }
+        struct stat st;
+        if (fstat(fd, &st))
+        {
+            HSCPP_DLOG(Error, "stat %s failed! %s", path.c_str(), strerror(errno));
+            close(fd);
+            return HS_INVALID;
+        }
+
+        size_t size = static_cast<size_t>(st.st_size);
+        FileCtx fctx(path, size, ctx);
+        bool streaming = (gen->mode & HS_MODE_STREAM) != 0;
+        // hyperscan takes 32-bit lengths, so a streaming scan of a file over 4GB is always windowed.
+        bool windowed = size > file_threshold || size > std::numeric_limits<unsigned int>::max();
+        size_t window = streaming && windowed ? file_window.load() : size;
+        if (!streaming && size > std::numeric_limits<unsigned int>::max())
+        {
+            HSCPP_DLOG(Error, "%s is larger than 4GB, scan it with a streaming matcher!", path.c_str());
+            close(fd);
+            return HS_INVALID;
+        }
+
+        std::vector<hs_stream_t *> streams;
+        int ret = HS_SUCCESS;
+        if (streaming)
+        {
+            for (auto &&db : gen->dbs)
+            {
+                hs_stream_t *stream = nullptr;
+                ret = hs_open_stream(db, 0, &stream);
+                if (ret != HS_SUCCESS)
+                {
+                    HSCPP_DLOG(Error, "hs open stream error! error no is%d", ret);
+                    break;
+                }
+                streams.push_back(stream);
+            }
+        }
+
+        HandlerCtx<MatchCb> scanctx{&handler, &fctx, &gen->index, gen->HitRow(), nullptr, 0};
+        bool reading = file_read.load();
+        std::vector<char> buffer;
+        if (reading)
+        {
+            buffer.resize(size < window ? size : window);
+        }
+        for (size_t pos = 0; pos < size && ret == HS_SUCCESS; pos += window)
+        {
+            size_t len = size - pos < window ? size - pos : window;
+            void *map = nullptr;
+            if (reading)
+            {
+                size_t got = 0;
+                ssize_t n = 1;
+                while (got < len && n > 0)
+                {
+                    n = pread(fd, buffer.data() + got, len - got, static_cast<off_t>(pos + got));
+                    if (n > 0)
+                    {
+                        got += static_cast<size_t>(n);
+                    }
+                    else if (n < 0 && errno == EINTR)
+                    {
+                        n = 1;
+                    }
+                }
+                if (n < 0)
+                {
+                    HSCPP_DLOG(Error, "read %s failed! %s", path.c_str(), strerror(errno));
+                    ret = HS_INVALID;
+                    break;
+                }
+                if (got < len)
+                {
+                    // the file was truncated meanwhile, what is left of it is scanned.
+                    HSCPP_DLOG(Notice, "%s shrank to %zu bytes while it was scanned.", path.c_str(), pos + got);
+                    size = pos + got;
+                    len = got;
+                }
+            }
+            else
+            {
+                map = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, static_cast<off_t>(pos));
+                if (map == MAP_FAILED)
+                {
+                    HSCPP_DLOG(Error, "mmap %s failed! %s", path.c_str(), strerror(errno));
+                    ret = HS_INVALID;
+                    break;
+                }
+                madvise(map, len, MADV_SEQUENTIAL);
+            }
+            const char *chunk = map ? static_cast<const char *>(map) : buffer.data();
+
+            if (streaming)
+            {
+                StatsTimer timer(gen->stats.get(), StatsKind::stream, len);
+                uint32_t slot;
+                auto scr = gen->scratch->GetSafeScratch(slot);
+                for (auto &&stream : streams)
+                {
+                    ret = hs_scan_stream(stream, chunk, static_cast<unsigned int>(len), 0, scr, OnHit<MatchCb>, &scanctx);
+                    if (ret != HS_SUCCESS)
+                    {
+                        break;
+                    }
+                }
+                gen->scratch->Release(slot);
+            }
+            else
+            {
+                ret = ScanData(*gen, DataBlock(chunk, len), handler, &fctx, true);
+            }
+            if (map)
+            {
+                munmap(map, len);
+            }
+        }
+        close(fd);
+
+        if (!streams.empty())
+        {
+            // end-of-data matches are only reported if the whole file was scanned.
+            uint32_t slot;
+            auto scr = gen->scratch->GetSafeScratch(slot);
+            for (auto &&stream : streams)
+            {
+                if (ret == HS_SUCCESS)
+                {
+                    ret = hs_close_stream(stream, scr, OnHit<MatchCb>, &scanctx);
+                }
+                else
+                {
+                    hs_close_stream(stream, nullptr, nullptr, nullptr);
+                }
+            }
+            gen->scratch->Release(slot);
+        }
+        return ret;
+    }
+
+    int HsMatcher::MatchFile(const std::string &path, UserCtx *ctx)
+    {
+        return ScanFile(path, cb_handler, ctx);
+    }
+
+    int HsMatcher::MatchFile(const std::string &path, MatchCb handler, UserCtx *ctx)
+    {
+        return ScanFile(path, handler, ctx);
+    }
+
+    int HsMatcher::MatchTree(const std::string &dir, uint32_t threads, UserCtx *ctx)
+    {
+        return MatchTree(dir, threads, cb_handler, ctx);
+    }
+
+    int HsMatcher::MatchTree(const std::string &dir, uint32_t threads, MatchCb handler, UserCtx *ctx)
+    {
+        std::vector<std::string> files;
+        ListTree(dir, files);
+        if (!threads)
+        {
+            threads = std::thread::hardware_concurrency();
+        }
+        if (!threads)
+        {
+            threads = 1;
+        }
+
+        std::atomic<size_t> next(0);
+        std::atomic<int> ret(HS_SUCCESS);
+        auto work = [&]()
+        {
+            size_t i;
+            while ((i = next++) < files.size())
+            {
+                int res = ScanFile(files[i], handler, ctx);
+                if (res != HS_SUCCESS && res != HS_SCAN_TERMINATED)
+                {
+                    ret = res;
+                }
+            }
+        };
+
+        std::vector<std::thread> pool;
+        for (uint32_t i = 1; i < threads && i < files.size(); i++)
+        {
+            pool.emplace_back(work);
+        }
+        work();
+        for (auto &&th : pool)
+        {
+            th.join();
+        }
+        return ret;
+    }
+}
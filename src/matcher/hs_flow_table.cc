@@ -0,0 +1,318 @@
+#include "hs_flow_table.h"
+#include <algorithm>
+#include <limits>
+#include "debug_log.h"
+
+namespace Echidna
+{
+    HsFlowTable::HsFlowTable(HsMatcher &umatcher, size_t ubudget)
+        : matcher(umatcher),
+          cb_handler(umatcher.cb_handler),
+          budget(ubudget),
+          head(nullptr),
+          tail(nullptr),
+          trim_at(arena.SlabSize()),
+          evictions(0) {}
+
+    HsFlowTable::HsFlowTable(HsMatcher &umatcher, size_t ubudget, MatchCb cb)
+        : matcher(umatcher),
+          cb_handler(cb),
+          budget(ubudget),
+          head(nullptr),
+          tail(nullptr),
+          trim_at(arena.SlabSize()),
+          evictions(0) {}
+
+    HsFlowTable::~HsFlowTable()
+    {
+        clear();
+    }
+
+    void HsFlowTable::clear()
+    {
+        for (auto &&flow : flows)
+        {
+            arena.Free(flow.second.state, flow.second.cls, flow.second.len);
+        }
+        flows.clear();
+        head = tail = nullptr;
+        arena.Trim();
+        for (auto &&stream : working)
+        {
+            hs_close_stream(stream, nullptr, nullptr, nullptr);
+        }
+        working.clear();
+        gen.reset();
+    }
+
+    int HsFlowTable::Bind()
+    {
+        if (gen)
+        {
+            return HS_SUCCESS;
+        }
+
+        gen = matcher.Acquire();
+        if (!gen)
+        {
+            return HS_INVALID;
+        }
+
+        if (!(gen->mode & HS_MODE_STREAM))
+        {
+            HSCPP_DLOG(Error, "the matcher is not in stream mode, flow table can't be used!");
+            gen.reset();
+            return HS_DB_MODE_ERROR;
+        }
+
+        int ret = HS_SUCCESS;
+        size_t state_size = 0;
+        for (auto &&db : gen->dbs)
+        {
+            hs_stream_t *stream = nullptr;
+            size_t size = 0;
+            ret = hs_open_stream(db, 0, &stream);
+            if (ret != HS_SUCCESS)
+            {
+                break;
+            }
+            working.push_back(stream);
+            if (hs_stream_size(db, &size) == HS_SUCCESS)
+            {
+                state_size += size + sizeof(uint32_t);
+            }
+        }
+        if (ret != HS_SUCCESS)
+        {
+            HSCPP_DLOG(Error, "hs open stream error! error no is%d", ret);
+            clear();
+            return ret;
+        }
+        // a compressed state is never larger than the full one, so the buffer rarely grows.
+        buffer.resize(state_size);
+        return HS_SUCCESS;
+    }
+
+    int HsFlowTable::Expand(const Flow &flow)
+    {
+        // the state is the compressed stream of every shard, each one led by its length.
+        const char *cur = flow.state;
+        for (auto &&stream : working)
+        {
+            uint32_t len;
+            memcpy(&len, cur, sizeof(len));
+            cur += sizeof(len);
+            int ret = hs_reset_and_expand_stream(stream, cur, len, nullptr, nullptr, nullptr);
+            if (ret != HS_SUCCESS)
+            {
+                HSCPP_DLOG(Error, "hs expand stream error! error no is%d", ret);
+                return ret;
+            }
+            cur += len;
+        }
+        return HS_SUCCESS;
+    }
+
+    int HsFlowTable::Compress(Flow &flow)
+    {
+        size_t used = 0;
+        for (auto &&stream : working)
+        {
+            size_t len = 0;
+            int ret;
+            while (true)
+            {
+                if (buffer.size() < used + sizeof(uint32_t))
+                {
+                    buffer.resize(used + sizeof(uint32_t));
+                }
+                ret = hs_compress_stream(stream, buffer.data() + used + sizeof(uint32_t), buffer.size() - used - sizeof(uint32_t), &len);
+                if (ret != HS_INSUFFICIENT_SPACE)
+                {
+                    break;
+                }
+                buffer.resize(used + sizeof(uint32_t) + len);
+            }
+            if (ret != HS_SUCCESS)
+            {
+                HSCPP_DLOG(Error, "hs compress stream error! error no is%d", ret);
+                return ret;
+            }
+            uint32_t len32 = static_cast<uint32_t>(len);
+            memcpy(buffer.data() + used, &len32, sizeof(len32));
+            used += sizeof(len32) + len;
+        }
+
+        // keep the block if the state still fits its size class.
+        if (!flow.state || flow.cls == SlabArena::LARGE || used > SlabArena::ClassSize(flow.cls) ||
+            (flow.cls > 0 && used <= SlabArena::ClassSize(flow.cls - 1)))
+        {
+            arena.Free(flow.state, flow.cls, flow.len);
+            flow.state = arena.Alloc(used, flow.cls);
+            if (!flow.state)
+            {
+                HSCPP_DLOG(Error, "out of memory, flow %llu is dropped!", static_cast<unsigned long long>(flow.key));
+                flow.len = 0;
+                return HS_NOMEM;
+            }
+        }
+        memcpy(flow.state, buffer.data(), used);
+        flow.len = static_cast<uint32_t>(used);
+        return HS_SUCCESS;
+    }
+
+    void HsFlowTable::Link(Flow &flow)
+    {
+        flow.prev = nullptr;
+        flow.next = head;
+        if (head)
+        {
+            head->prev = &flow;
+        }
+        head = &flow;
+        if (!tail)
+        {
+            tail = &flow;
+        }
+    }
+
+    void HsFlowTable::Unlink(Flow &flow)
+    {
+        (flow.prev ? flow.prev->next : head) = flow.next;
+        (flow.next ? flow.next->prev : tail) = flow.prev;
+        flow.prev = flow.next = nullptr;
+    }
+
+    void HsFlowTable::Drop(Flow &flow)
+    {
+        Unlink(flow);
+        arena.Free(flow.state, flow.cls, flow.len);
+        flows.erase(flow.key);
+    }
+
+    void HsFlowTable::Evict(const Flow &keep)
+    {
+        if (!budget)
+        {
+            return;
+        }
+        // freed blocks are only given back to the heap with their whole slab, so flows are evicted until
+        // enough slabs are empty.
+        trim_at = std::min(trim_at, arena.Reserved() - arena.InUse() + arena.SlabSize());
+        while (TotalBytes() > budget && tail && tail != &keep)
+        {
+            Drop(*tail);
+            evictions++;
+            if (arena.Reserved() - arena.InUse() >= trim_at)
+            {
+                arena.Trim();
+                trim_at = arena.Reserved() - arena.InUse() + arena.SlabSize();
+            }
+        }
+    }
+
+    int HsFlowTable::Write(uint64_t key, const char *data, size_t len, UserCtx *ctx)
+    {
+        int ret = Bind();
+        if (ret != HS_SUCCESS)
+        {
+            return ret;
+        }
+
+        auto it = flows.find(key);
+        bool fresh = it == flows.end();
+        if (fresh)
+        {
+            it = flows.emplace(key, Flow{key, nullptr, 0, 0, nullptr, nullptr}).first;
+            // a new flow starts from a clean stream, nothing is reported for the one before.
+            for (auto &&stream : working)
+            {
+                hs_reset_stream(stream, 0, nullptr, nullptr, nullptr);
+            }
+        }
+        else
+        {
+            Unlink(it->second);
+            ret = Expand(it->second);
+            if (ret != HS_SUCCESS)
+            {
+                arena.Free(it->second.state, it->second.cls, it->second.len);
+                flows.erase(it);
+                return ret;
+            }
+        }
+        Flow &flow = it->second;
+        Link(flow);
+
+        StatsTimer timer(gen->stats.get(), StatsKind::stream, len);
+        HsMatcher::HandlerCtx<MatchCb> scanctx{&cb_handler, ctx, &gen->index, gen->HitRow(), nullptr, 0};
+        uint32_t slot;
+        auto scr = gen->scratch->GetSafeScratch(slot);
+        while (len && ret == HS_SUCCESS)
+        {
+            // hyperscan takes 32-bit lengths, larger chunks are split.
+            unsigned int piece = len > std::numeric_limits<unsigned int>::max() ? std::numeric_limits<unsigned int>::max() : static_cast<unsigned int>(len);
+            for (auto &&stream : working)
+            {
+                ret = hs_scan_stream(stream, data, piece, 0, scr, HsMatcher::OnHit<MatchCb>, &scanctx);
+                if (ret != HS_SUCCESS)
+                {
+                    break;
+                }
+            }
+            data += piece;
+            len -= piece;
+        }
+        gen->scratch->Release(slot);
+
+        int res = Compress(flow);
+        if (res != HS_SUCCESS)
+        {
+            Drop(flow);
+            return res;
+        }
+        Evict(flow);
+        return ret;
+    }
+
+    int HsFlowTable::Write(uint64_t flow, const std::string &data, UserCtx *ctx)
+    {
+        return Write(flow, data.data(), data.size(), ctx);
+    }
+
+    int HsFlowTable::Close(uint64_t key, UserCtx *ctx)
+    {
+        auto it = flows.find(key);
+        if (it == flows.end())
+        {
+            return HS_INVALID;
+        }
+
+        Flow &flow = it->second;
+        int ret = Expand(flow);
+        if (ret == HS_SUCCESS)
+        {
+            // resetting the working streams reports their end-of-data matches.
+            HsMatcher::HandlerCtx<MatchCb> scanctx{&cb_handler, ctx, &gen->index, gen->HitRow(), nullptr, 0};
+            uint32_t slot;
+            auto scr = gen->scratch->GetSafeScratch(slot);
+            for (auto &&stream : working)
+            {
+                auto res = hs_reset_stream(stream, 0, scr, HsMatcher::OnHit<MatchCb>, &scanctx);
+                if (res != HS_SUCCESS)
+                {
+                    ret = res;
+                }
+            }
+            gen->scratch->Release(slot);
+        }
+        Drop(flow);
+        return ret;
+    }
+
+    size_t HsFlowTable::FlowBytes(uint64_t key) const
+    {
+        auto it = flows.find(key);
+        return it == flows.end() ? 0 : it->second.len;
+    }
+}
@@ -0,0 +1,139 @@
+#pragma once
+#include "hs_matcher.h"
+#include "slab_arena.h"
+#include <unordered_map>
+
+namespace Echidna
+{
+    /**
+     * it keeps the stream state of many concurrent flows (e.g. network connections) on a streaming
+     * @ref HsMatcher, in a fraction of the memory of one open @ref HsStream per flow.
+     *
+     * Only the flow being written is a live stream. Between writes every flow is kept compressed with
+     * hs_compress_stream in a slab arena, and it is expanded again when its next data arrives. When the
+     * table holds more memory than its budget the least recently written flows are evicted, without
+     * reporting their end-of-data matches, until enough slabs of the arena are empty to give back.
+     *
+     * Like @ref HsStream, the table keeps scanning with the database it started with, patterns changed later
+     * are used after @ref clear(). A table is not thread safe, use one table per thread.
+     */
+    class HsFlowTable
+    {
+    public:
+        HsFlowTable() = delete;
+        HsFlowTable(const HsFlowTable &) = delete;
+        HsFlowTable &operator=(const HsFlowTable &) = delete;
+
+        /**
+         * @param matcher
+         *      the streaming matcher to scan with.
+         * @param budget
+         *      bytes of flow state to keep at most, see @ref TotalBytes(). 0 means no limit.
+         */
+        HsFlowTable(HsMatcher &matcher, size_t budget = 0);
+
+        /**
+         * @param cb
+         *      it will be called instead of the one registed to the matcher when hit.
+         */
+        HsFlowTable(HsMatcher &matcher, size_t budget, MatchCb cb);
+
+        /**
+         * Flows still in the table are dropped, their end-of-data matches are not reported.
+         */
+        ~HsFlowTable();
+
+        /**
+         * Scan the next chunk of a flow, the flow is opened if it is not in the table.
+         *
+         * @param flow
+         *      any key that identifies the flow, e.g. a hash of the 5-tuple.
+         * @param ctx
+         *      it will be passed to the callback function if hit.
+         * @return HS_SUCCESS, HS_SCAN_TERMINATED if the callback asked to stop, HS_NOMEM if the state of the
+         *      flow can't be kept (the flow is dropped), or a hyperscan error code.
+         */
+        int Write(uint64_t flow, const char *data, size_t len, UserCtx *ctx = nullptr);
+        int Write(uint64_t flow, const std::string &data, UserCtx *ctx = nullptr);
+
+        /**
+         * Close a flow, matches that can only be confirmed at the end of data will be reported.
+         */
+        int Close(uint64_t flow, UserCtx *ctx = nullptr);
+
+        /**
+         * Drop all flows without reporting their end-of-data matches. The next write uses the database the
+         * matcher has now.
+         */
+        void clear();
+
+        /**
+         * change the memory budget, flows are evicted at the next write if needed. 0 means no limit.
+         */
+        void SetBudget(size_t ubudget) { budget = ubudget; }
+
+        bool Contains(uint64_t flow) const { return flows.count(flow) != 0; }
+
+        /**
+         * bytes of the compressed state of a flow, 0 if it is not in the table.
+         */
+        size_t FlowBytes(uint64_t flow) const;
+
+        /**
+         * bytes the table holds: the slabs of the arena, free blocks included, and the table entries. It is
+         * what the budget is compared with.
+         */
+        size_t TotalBytes() const { return arena.Reserved() + flows.size() * FLOW_OVERHEAD; }
+
+        /**
+         * bytes of the states of the flows and the table entries, without the free blocks of the arena.
+         */
+        size_t LiveBytes() const { return arena.InUse() + flows.size() * FLOW_OVERHEAD; }
+
+        size_t Flows() const { return flows.size(); }
+
+        /**
+         * number of flows evicted to keep the budget.
+         */
+        uint64_t Evictions() const { return evictions; }
+
+    private:
+        struct Flow
+        {
+            uint64_t key;
+            char *state;
+            uint32_t cls;
+            uint32_t len;
+            // least recently written flows are at the tail.
+            Flow *prev;
+            Flow *next;
+        };
+
+        // a rough cost of a table entry besides its state: the node and its bucket.
+        constexpr static size_t FLOW_OVERHEAD = sizeof(std::pair<const uint64_t, Flow>) + 2 * sizeof(void *);
+
+        int Bind();
+        int Expand(const Flow &flow);
+        int Compress(Flow &flow);
+        void Drop(Flow &flow);
+        void Link(Flow &flow);
+        void Unlink(Flow &flow);
+        void Evict(const Flow &keep);
+
+        HsMatcher &matcher;
+        MatchCb cb_handler;
+        size_t budget;
+        HsDatabasePtr gen;
+        // the live stream of every shard, each write expands a flow into them.
+        std::vector<hs_stream_t *> working;
+        // reused to compress the working streams before they are copied to the arena.
+        std::vector<char> buffer;
+        std::unordered_map<uint64_t, Flow> flows;
+        Flow *head;
+        Flow *tail;
+        SlabArena arena;
+        // free bytes of the arena at which to trim it next, so that it isn't walked on every eviction.
+        size_t trim_at;
+        uint64_t evictions;
+    };
+}
@@ -1,130 +1,394 @@
 #include "hs_matcher.h"
 #include <algorithm>
+#include <thread>
+#include <chrono>
+#include <stdio.h>
 #include "debug_log.h"
 
 namespace Echidna
 {
 
-    struct ScanCtx
+    namespace
     {
-        MatchCb cb_handler;
-        UserCtx *ctx;
-        std::vector<PatPtr> *patterns;
-    };
+        std::atomic<uint64_t> scratch_generation(0);
 
-    Scratch::Scratch(hs_database_t *db)
+        /**
+         * the slot the thread used last time, and the pool it belongs to.
+         */
+        struct ScratchCache
+        {
+            uint64_t generation;
+            uint32_t slot;
+        };
+
+        thread_local ScratchCache scratch_cache{0, 0};
+
+        // the temporary scratches of the thread taken while a pool was full, the last one is released first.
+        thread_local std::vector<hs_scratch_t *> scratch_spares;
+
+        // yields to wait for a release of a full pool before a temporary scratch is cloned.
+        constexpr int SPARE_AFTER = 64;
+
+        // epochs of all matchers, and the matchers destroyed so far.
+        std::atomic<uint64_t> publish_epoch(0);
+        std::atomic<uint64_t> matchers_gone(0);
+
+        /**
+         * a generation the thread scanned with, and the epoch of its matcher then.
+         */
+        struct GenCache
+        {
+            const HsMatcher *owner;
+            uint64_t epoch;
+            HsDatabasePtr gen;
+        };
+
+        constexpr size_t GEN_CACHE_SIZE = 4;
+        thread_local GenCache gen_cache[GEN_CACHE_SIZE];
+        thread_local size_t gen_victim = 0;
+        thread_local uint64_t gen_gone = 0;
+        // leases in flight on the thread, and the generations replaced meanwhile.
+        thread_local uint32_t lease_depth = 0;
+        thread_local std::vector<HsDatabasePtr> gen_retired;
+
+        void Evict(GenCache &entry)
+        {
+            // an outer scan of the thread may still use it.
+            if (entry.gen && lease_depth > 1)
+            {
+                gen_retired.push_back(std::move(entry.gen));
+            }
+            entry.gen.reset();
+            entry.owner = nullptr;
+        }
+    }
+
+    constexpr uint32_t Scratch::SPARE_SLOT;
+    constexpr size_t HsMatcher::STREAM_PIECE;
+
+    Scratch::Scratch(hs_database_t *db, uint32_t max_size)
+        : prototype(nullptr),
+          generation(++scratch_generation),
+          capacity(max_size ? max_size : 1),
+          size(0),
+          ScrPool(new ScratchData[max_size ? max_size : 1]),
+          free_head(0)
+    {
+        Alloc(db);
+    }
+
+    Scratch::Scratch(const std::vector<hs_database_t *> &dbs, uint32_t max_size)
+        : prototype(nullptr),
+          generation(++scratch_generation),
+          capacity(max_size ? max_size : 1),
+          size(0),
+          ScrPool(new ScratchData[max_size ? max_size : 1]),
+          free_head(0)
+    {
+        // hyperscan grows the prototype until it fits every database.
+        for (auto &&db : dbs)
+        {
+            Alloc(db);
+        }
+    }
+
+    void Scratch::Alloc(hs_database_t *db)
     {
-        auto res = hs_alloc_scratch(db, &prototype.scr);
-        prototype.in_use = false;
+        auto res = hs_alloc_scratch(db, &prototype);
+        if (res != HS_SUCCESS)
+        {
+            HSCPP_DLOG(Error, "hs alloc scratch error! error no is%d", res);
+        }
     }
 
     Scratch::~Scratch()
     {
-        hs_free_scratch(prototype.scr);
-        for (auto &&i : ScrPool)
+        hs_free_scratch(prototype);
+        uint32_t n = size.load();
+        for (uint32_t i = 0; i < n; i++)
         {
-            hs_free_scratch(i.scr);
+            hs_free_scratch(ScrPool[i].scr);
         }
     }
 
     hs_scratch_t *Scratch::GetScratch()
     {
-        return prototype.scr;
+        return prototype;
+    }
+
+    hs_scratch_t *Scratch::Clone()
+    {
+        hs_scratch_t *scr = nullptr;
+        auto res = hs_clone_scratch(prototype, &scr);
+        if (res != HS_SUCCESS)
+        {
+            HSCPP_DLOG(Error, "hs clone scratch error! error no is%d", res);
+        }
+        return scr;
+    }
+
+    bool Scratch::TryTake(uint32_t slot)
+    {
+        bool expected = false;
+        return ScrPool[slot].in_use.compare_exchange_strong(expected, true, std::memory_order_acquire);
     }
 
-    hs_scratch_t *Scratch::GetSafeScratch()
+    void Scratch::Push(uint32_t slot)
     {
-        hs_scratch_t *res = nullptr;
-        for (auto &&i : ScrPool)
+        uint64_t head = free_head.load(std::memory_order_relaxed);
+        uint64_t desired;
+        do
         {
-            if (!i.in_use)
+            ScrPool[slot].next.store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+            desired = (((head >> 32) + 1) << 32) | (slot + 1);
+        } while (!free_head.compare_exchange_weak(head, desired, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    bool Scratch::Pop(uint32_t &slot)
+    {
+        uint64_t head = free_head.load(std::memory_order_acquire);
+        uint64_t desired;
+        do
+        {
+            uint32_t first = static_cast<uint32_t>(head);
+            if (!first)
             {
-                i.mtx.lock();
-                if (!i.in_use)
+                return false;
+            }
+            desired = (((head >> 32) + 1) << 32) | ScrPool[first - 1].next.load(std::memory_order_relaxed);
+        } while (!free_head.compare_exchange_weak(head, desired, std::memory_order_acquire, std::memory_order_acquire));
+        slot = static_cast<uint32_t>(head) - 1;
+        return true;
+    }
+
+    hs_scratch_t *Scratch::GetSafeScratch(uint32_t &slot)
+    {
+        // fast path: the slot this thread released last time is most likely still free.
+        if (scratch_cache.generation == generation && TryTake(scratch_cache.slot))
+        {
+            slot = scratch_cache.slot;
+            return ScrPool[slot].scr;
+        }
+
+        int waits = 0;
+        while (true)
+        {
+            if (Pop(slot))
+            {
+                ScrPool[slot].listed.store(false, std::memory_order_release);
+                // a thread may have taken it by its cached slot while it was listed.
+                if (!TryTake(slot))
+                {
+                    continue;
+                }
+                break;
+            }
+
+            uint32_t n = size.load(std::memory_order_acquire);
+            if (n < capacity)
+            {
+                if (!size.compare_exchange_weak(n, n + 1, std::memory_order_acq_rel))
+                {
+                    continue;
+                }
+                slot = n;
+                auto res = hs_clone_scratch(prototype, &ScrPool[slot].scr);
+                if (res != HS_SUCCESS)
                 {
-                    res = i.scr;
-                    i.in_use = true;
-                    i.mtx.unlock();
-                    break;
+                    HSCPP_DLOG(Error, "hs clone scratch error! error no is%d", res);
                 }
-                i.mtx.unlock();
+                ScrPool[slot].in_use.store(true, std::memory_order_release);
+                break;
+            }
+
+            // the pool is full, wait for a scratch to be released. All of them may be held by callers up the
+            // stack, e.g. a scan from a callback, so the wait is short.
+            if (++waits < SPARE_AFTER)
+            {
+                std::this_thread::yield();
                 continue;
             }
+            HSCPP_DLOG(Notice, "scratch pool is full, a temporary scratch is used.");
+            hs_scratch_t *spare = Clone();
+            scratch_spares.push_back(spare);
+            slot = SPARE_SLOT;
+            return spare;
         }
 
-        if (!res)
-        {
-            PoolMtx.lock();
-            ScratchData dolly;
-            hs_clone_scratch(prototype.scr, &dolly.scr);
-            dolly.in_use = true;
-            res = dolly.scr;
-            ScrPool.push_back(dolly);
-            PoolMtx.unlock();
-        }
-        return res;
+        scratch_cache.generation = generation;
+        scratch_cache.slot = slot;
+        return ScrPool[slot].scr;
     }
 
-    void Scratch::Release(hs_scratch_t *scr)
+    void Scratch::Release(uint32_t slot)
     {
-        for (auto &&i : ScrPool)
+        if (slot == SPARE_SLOT)
         {
-            if (i.scr == scr)
+            if (!scratch_spares.empty())
             {
-                i.mtx.lock();
-                i.in_use = false;
-                i.mtx.unlock();
-                break;
+                hs_free_scratch(scratch_spares.back());
+                scratch_spares.pop_back();
             }
+            return;
+        }
+        ScrPool[slot].in_use.store(false, std::memory_order_release);
+        if (!ScrPool[slot].listed.exchange(true, std::memory_order_acq_rel))
+        {
+            Push(slot);
         }
     }
 
+    HsDatabase::~HsDatabase()
+    {
+        if (hits)
+        {
+            stats->Retire(hits.get());
+        }
+        scratch.reset();
+        for (auto &&db : dbs)
+        {
+            hs_free_database(db);
+        }
+    }
+
+    void HsDatabase::InitHits()
+    {
+        std::vector<uint32_t> ids(index.size());
+        for (uint32_t slot = 0; slot < ids.size(); slot++)
+        {
+            ids[slot] = index.At(slot).id;
+        }
+        hits.reset(new HitCounters(ids, HsStats::SHARDS));
+        stats->Attach(hits.get());
+    }
+
     HsMatcher::HsMatcher()
-        : db(nullptr),
-          updated(true),
-          compile_mode(HS_MODE_BLOCK),
-          cb_handler(defaultcb) {}
+        : options{HS_MODE_BLOCK, 1, ShardPolicy::count, nullptr, false, 1024, true},
+          cb_handler(defaultcb),
+          file_threshold(1ull << 30),
+          file_window(64ull << 20),
+          file_read(false),
+          stats(std::make_shared<HsStats>()),
+          epoch(++publish_epoch),
+          requested(0),
+          attempted(0),
+          published(0),
+          stop(false),
+          compact_after(0) {}
 
     HsMatcher::~HsMatcher()
     {
-        if (db)
         {
-            hs_free_database(db);
+            std::lock_guard<std::mutex> lock(mtx);
+            stop = true;
         }
+        work_cv.notify_all();
+        if (worker.joinable())
+        {
+            worker.join();
+        }
+        // threads drop the generations they cached, this one's among them.
+        matchers_gone++;
+    }
+
+    void HsMatcher::Schedule()
+    {
+        // called with mtx held.
+        requested++;
+        if (!worker.joinable())
+        {
+            worker = std::thread(&HsMatcher::CompileLoop, this);
+        }
+        work_cv.notify_one();
     }
 
     void HsMatcher::push_back(Hs_Pattern &pat)
     {
         auto patptr = std::make_shared<Hs_Pattern>(pat);
+        std::lock_guard<std::mutex> lock(mtx);
         patterns.push_back(patptr);
-        updated = true;
+        Schedule();
     }
 
     void HsMatcher::push_back(const std::string &pat)
     {
         auto patptr = std::make_shared<Hs_Pattern>(pat);
+        std::lock_guard<std::mutex> lock(mtx);
         patterns.push_back(patptr);
-        updated = true;
+        Schedule();
+    }
+
+    void HsMatcher::push_back(PatternStore &&store)
+    {
+        auto storeptr = std::make_shared<PatternStore>(std::move(store));
+        std::lock_guard<std::mutex> lock(mtx);
+        stores.push_back(storeptr);
+        Schedule();
     }
 
     void HsMatcher::erase(Hs_Pattern &pat, std::function<int(Hs_Pattern &, Hs_Pattern &)> equal)
     {
-        std::remove_if(patterns.begin(), patterns.end(),
-                       [&](PatPtr patptr)
-                       {
-                           return equal(*dynamic_cast<Hs_Pattern *>(patptr.get()), pat);
-                       });
-        updated = true;
+        std::lock_guard<std::mutex> lock(mtx);
+        patterns.erase(std::remove_if(patterns.begin(), patterns.end(),
+                                      [&](PatPtr patptr)
+                                      {
+                                          return equal(*dynamic_cast<Hs_Pattern *>(patptr.get()), pat);
+                                      }),
+                       patterns.end());
+        Schedule();
     }
 
     void HsMatcher::erase(uint32_t id)
     {
-        std::remove_if(patterns.begin(), patterns.end(),
-                       [&](PatPtr patptr)
-                       {
-                           return dynamic_cast<Hs_Pattern *>(patptr.get())->GetId() == id;
-                       });
-        updated = true;
+        std::lock_guard<std::mutex> lock(mtx);
+        EraseIds(std::vector<uint32_t>(1, id));
+        disabled.erase(id);
+        Schedule();
+    }
+
+    bool HsMatcher::EraseIds(const std::vector<uint32_t> &ids)
+    {
+        // called with mtx held.
+        std::vector<uint32_t> sorted(ids);
+        std::sort(sorted.begin(), sorted.end());
+        auto contains = [&sorted](uint32_t id)
+        {
+            return std::binary_search(sorted.begin(), sorted.end(), id);
+        };
+        size_t before = patterns.size();
+        patterns.erase(std::remove_if(patterns.begin(), patterns.end(),
+                                      [&](PatPtr patptr)
+                                      {
+                                          return contains(dynamic_cast<Hs_Pattern *>(patptr.get())->GetId());
+                                      }),
+                       patterns.end());
+        bool changed = patterns.size() != before;
+        // generations share the stores, so a shared store is copied once and the copy changed. A store only
+        // the matcher holds is changed in place, no generation can take it while mtx is held.
+        for (auto &&store : stores)
+        {
+            std::shared_ptr<PatternStore> copy;
+            for (auto &&id : sorted)
+            {
+                if (store->Find(id) == PatternStore::npos)
+                {
+                    continue;
+                }
+                if (!copy)
+                {
+                    // stores are created non-const by push_back(), so casting const away is fine.
+                    copy = store.use_count() > 1 ? std::make_shared<PatternStore>(store->Clone())
+                                                 : std::const_pointer_cast<PatternStore>(store);
+                }
+                copy->Remove(id);
+            }
+            if (copy)
+            {
+                store = copy;
+                changed = true;
+            }
+        }
+        return changed;
     }
 
     void HsMatcher::RegisteCb(MatchCb cb)
@@ -134,6 +398,7 @@ namespace Echidna
 
     PatPtr HsMatcher::find(uint32_t id)
     {
+        std::lock_guard<std::mutex> lock(mtx);
         for (auto &&i : patterns)
         {
             if (dynamic_cast<Hs_Pattern *>(i.get())->GetId() == id)
@@ -141,153 +406,675 @@ namespace Echidna
                 return i;
             }
         }
+        for (auto &&store : stores)
+        {
+            size_t slot = store->Find(id);
+            if (slot != PatternStore::npos)
+            {
+                PatternRef ref = store->At(slot);
+                auto pat = Hs_Pattern::Restore(std::string(ref.expr, ref.len), ref.id, ref.flag, ref.ext);
+                pat->SetLiteral(ref.literal);
+                pat->SetCapture(ref.capture);
+                return pat;
+            }
+        }
         return nullptr;
     }
 
     void HsMatcher::clear()
     {
-        updated = true;
-        hs_free_database(db);
-        db = nullptr;
-        scratch.reset();
+        std::lock_guard<std::mutex> lock(mtx);
         patterns.clear();
+        stores.clear();
+        disabled.clear();
+        // nothing to compile, publish the empty matcher directly.
+        requested++;
+        Publish(nullptr, requested);
     }
 
     void HsMatcher::SetMode(MatchMode umode)
     {
+        std::lock_guard<std::mutex> lock(mtx);
+        // block, stream and vectored are exclusive in hyperscan.
+        options.mode &= ~(HS_MODE_BLOCK | HS_MODE_STREAM | HS_MODE_VECTORED);
         switch (umode)
         {
         case (MatchMode::block):
-            compile_mode |= HS_MODE_BLOCK;
+            options.mode |= HS_MODE_BLOCK;
             break;
         case (MatchMode::stream):
-            compile_mode |= HS_MODE_STREAM;
+            options.mode |= HS_MODE_STREAM;
             break;
         case (MatchMode::vector):
-            compile_mode |= HS_MODE_VECTORED;
+            options.mode |= HS_MODE_VECTORED;
             break;
         default:
-            compile_mode |= HS_MODE_BLOCK;
+            options.mode |= HS_MODE_BLOCK;
             break;
         }
+        Schedule();
     }
 
     void HsMatcher::SetMatchFlag(LeftMatchFlag uflag)
     {
+        std::lock_guard<std::mutex> lock(mtx);
         switch (uflag)
         {
         case (LeftMatchFlag::large):
-            compile_mode |= HS_MODE_SOM_HORIZON_LARGE;
+            options.mode |= HS_MODE_SOM_HORIZON_LARGE;
             break;
         case (LeftMatchFlag::medium):
-            compile_mode |= HS_MODE_SOM_HORIZON_MEDIUM;
+            options.mode |= HS_MODE_SOM_HORIZON_MEDIUM;
             break;
         case (LeftMatchFlag::small):
-            compile_mode |= HS_MODE_SOM_HORIZON_SMALL;
+            options.mode |= HS_MODE_SOM_HORIZON_SMALL;
             break;
         case (LeftMatchFlag::none):
             break;
         default:
             break;
         }
+        Schedule();
     }
 
-    int HsMatcher::compile()
+    void HsMatcher::Publish(HsDatabasePtr gen, uint64_t version)
     {
-        scratch.reset();
-        if (db)
+        // called with mtx held. A slow build of older patterns must not replace a newer generation.
+        if (version > published)
         {
-            hs_free_database(db);
-            db = nullptr;
+            if (gen)
+            {
+                gen->version = version;
+                gen->stats = stats;
+                for (auto &&i : disabled)
+                {
+                    const PatternEntry *entry = gen->index.Find(i.first);
+                    if (entry)
+                    {
+                        gen->index.Mute(gen->index.Slot(entry), true);
+                    }
+                }
+                live.erase(std::remove_if(live.begin(), live.end(),
+                                          [](const std::weak_ptr<HsDatabase> &weak)
+                                          { return weak.expired(); }),
+                           live.end());
+                live.push_back(gen);
+            }
+            std::atomic_store(&current, gen);
+            epoch.store(++publish_epoch, std::memory_order_release);
+            published = version;
+        }
+        if (version > attempted)
+        {
+            attempted = version;
         }
+        done_cv.notify_all();
+    }
 
-        const char **expressions = new const char *[patterns.size()];
-        unsigned int *pflags = new unsigned int[patterns.size()];
-        unsigned int *ids = new unsigned int[patterns.size()];
-        hs_expr_ext_t **ext = new hs_expr_ext_t *[patterns.size()];
-        hs_compile_error_t *error = nullptr;
+    bool HsMatcher::MuteLive(uint32_t id, bool mute)
+    {
+        // called with mtx held. Streams and flow tables may still scan with older generations.
+        bool found = false;
+        for (auto &&weak : live)
+        {
+            auto gen = weak.lock();
+            const PatternEntry *entry = gen ? gen->index.Find(id) : nullptr;
+            if (entry)
+            {
+                gen->index.Mute(gen->index.Slot(entry), mute);
+                found = true;
+            }
+        }
+        return found;
+    }
 
-        for (int i = 0; i < patterns.size(); i++)
+    bool HsMatcher::Disable(uint32_t id)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        disabled.emplace(id, std::chrono::steady_clock::now());
+        if (compact_after.count())
         {
-            Hs_Pattern *pat = dynamic_cast<Hs_Pattern *>(patterns[i].get());
-            expressions[i] = pat->Get().data();
-            pflags[i] = pat->GetFlag();
-            ids[i] = pat->GetId();
-            ext[i] = pat->GetExFlag().get();
+            if (!worker.joinable())
+            {
+                worker = std::thread(&HsMatcher::CompileLoop, this);
+            }
+            work_cv.notify_one();
         }
+        return MuteLive(id, true);
+    }
 
-        auto ret = hs_compile_ext_multi(expressions, pflags, ids, ext, patterns.size(), compile_mode, nullptr, &db, &error);
-        if (ret != HS_SUCCESS)
+    bool HsMatcher::Enable(uint32_t id)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!disabled.erase(id))
         {
-            DLogger.DLog(LogType::Warning, "hs compile error! error no is" + std::to_string(ret) + " -> " + error->message);
+            return false;
         }
+        MuteLive(id, false);
+        return true;
+    }
 
-        scratch = std::make_shared<Scratch>(db);
-        hs_free_compile_error(error);
-        delete[] expressions;
-        delete[] pflags;
-        delete[] ids;
-        delete[] ext;
-        return ret;
+    bool HsMatcher::IsDisabled(uint32_t id)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return disabled.count(id) != 0;
     }
 
-    void HsMatcher::Match(const std::string &data, UserCtx *ctx)
+    void HsMatcher::SetCompaction(std::chrono::seconds after)
     {
-        if (patterns.size() == 0)
+        std::lock_guard<std::mutex> lock(mtx);
+        compact_after = after;
+        if (!disabled.empty() && worker.joinable())
+        {
+            work_cv.notify_one();
+        }
+    }
+
+    void HsMatcher::Compact()
+    {
+        // called with mtx held.
+        if (!compact_after.count() || disabled.empty())
+        {
+            return;
+        }
+        auto deadline = std::chrono::steady_clock::now() - compact_after;
+        std::vector<uint32_t> expired;
+        for (auto &&i : disabled)
+        {
+            if (i.second <= deadline)
+            {
+                expired.push_back(i.first);
+            }
+        }
+        if (expired.empty())
         {
-            DLogger.DLog(LogType::Notice, "The matcher is empty!");
             return;
         }
+        for (auto &&id : expired)
+        {
+            disabled.erase(id);
+        }
+        if (EraseIds(expired))
+        {
+            HSCPP_DLOG(Notice, "remove patterns disabled for %llds.", static_cast<long long>(compact_after.count()));
+            Schedule();
+        }
+    }
+
+    void HsMatcher::SetShards(uint32_t shards, ShardPolicy policy)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        options.shards = shards ? shards : 1;
+        options.policy = policy;
+        Schedule();
+    }
+
+    void HsMatcher::SetCompileCache(CompileCachePtr cache)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        options.cache = cache;
+    }
+
+    void HsMatcher::SetLiteralDetect(bool detect)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        options.detect_literals = detect;
+        Schedule();
+    }
 
-        if (!db || updated)
+    void HsMatcher::SetConfirmWindow(size_t window, bool pass)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        options.confirm_window = window;
+        options.confirm_pass = pass;
+        Schedule();
+    }
+
+    uint32_t HsMatcher::ShardCount()
+    {
+        auto gen = std::atomic_load(&current);
+        return gen ? static_cast<uint32_t>(gen->dbs.size()) : 0;
+    }
+
+    int HsMatcher::compile()
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        std::vector<PatPtr> snapshot = patterns;
+        std::vector<PatternStorePtr> store_snapshot = stores;
+        CompileOptions opts = options;
+        uint64_t version = requested;
+        lock.unlock();
+
+        HsDatabasePtr gen;
+        int ret;
         {
-            DLogger.DLog(LogType::Notice, "generate database automatically!");
-            auto ret = compile();
-            if (ret != HS_SUCCESS)
+            StatsTimer timer(stats.get(), StatsKind::compile);
+            ret = Build(snapshot, store_snapshot, opts, gen);
+        }
+
+        lock.lock();
+        if (ret == HS_SUCCESS)
+        {
+            Publish(gen, version);
+        }
+        else if (version > attempted)
+        {
+            attempted = version;
+            done_cv.notify_all();
+        }
+        return ret;
+    }
+
+    void HsMatcher::CompileLoop()
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        while (true)
+        {
+            if (!stop && requested <= attempted)
+            {
+                if (compact_after.count() && !disabled.empty())
+                {
+                    // wake up when the oldest disabled pattern is due to be removed.
+                    auto oldest = disabled.begin()->second;
+                    for (auto &&i : disabled)
+                    {
+                        oldest = std::min(oldest, i.second);
+                    }
+                    work_cv.wait_until(lock, oldest + compact_after);
+                }
+                else
+                {
+                    work_cv.wait(lock);
+                }
+            }
+            if (stop)
             {
-                DLogger.DLog(LogType::Error, "db compile update failed, match failed!");
                 return;
             }
-            updated = false;
+            Compact();
+            if (requested > attempted)
+            {
+                lock.unlock();
+                compile();
+                lock.lock();
+            }
+        }
+    }
+
+    void HsMatcher::Sync()
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        done_cv.wait(lock, [this]
+                     { return attempted >= requested; });
+    }
+
+    HsDatabasePtr HsMatcher::Acquire()
+    {
+        auto gen = std::atomic_load(&current);
+        if (!gen)
+        {
+            // nothing to scan with yet, this is the only time a scan waits for compiling.
+            Sync();
+            gen = std::atomic_load(&current);
+            if (!gen)
+            {
+                HSCPP_DLOG(Error, "no compiled database, match failed!");
+            }
+        }
+        return gen;
+    }
+
+    bool HsMatcher::Fits(size_t len)
+    {
+        if (len > STREAM_PIECE)
+        {
+            HSCPP_DLOG(Error, "%zu bytes are too many for one block scan, scan them with a stream!", len);
+            return false;
+        }
+        return true;
+    }
+
+    HsDatabase *HsMatcher::Cached()
+    {
+        lease_depth++;
+        uint64_t gone = matchers_gone.load(std::memory_order_acquire);
+        if (gone != gen_gone)
+        {
+            for (auto &&entry : gen_cache)
+            {
+                Evict(entry);
+            }
+            gen_gone = gone;
         }
 
-        auto scr = scratch->GetScratch();
-        ScanCtx scanctx{this->cb_handler, ctx, &this->patterns};
-        auto res = hs_scan(db, data.data(), data.size(), 0, scr, HsMatcher::callback, &scanctx);
+        // the epoch is read before current, so a publish in between is only seen by the next scan.
+        uint64_t now = epoch.load(std::memory_order_acquire);
+        GenCache *slot = nullptr;
+        for (auto &&entry : gen_cache)
+        {
+            if (entry.owner == this)
+            {
+                if (entry.epoch == now && entry.gen)
+                {
+                    return entry.gen.get();
+                }
+                slot = &entry;
+            }
+        }
+        if (!slot)
+        {
+            slot = &gen_cache[gen_victim++ % GEN_CACHE_SIZE];
+        }
+
+        auto gen = Acquire();
+        Evict(*slot);
+        slot->owner = this;
+        slot->epoch = now;
+        slot->gen = std::move(gen);
+        return slot->gen.get();
+    }
+
+    void HsMatcher::Lease::Release()
+    {
+        if (!--lease_depth)
+        {
+            gen_retired.clear();
+        }
+    }
+
+    void HsMatcher::Match(const std::string &data, UserCtx *ctx)
+    {
+        Match(DataBlock(data), cb_handler, ctx);
+    }
+
+    void HsMatcher::Match(DataBlock data, UserCtx *ctx)
+    {
+        Match(data, cb_handler, ctx);
+    }
+
+    void HsMatcher::Match(const char *data, size_t len, UserCtx *ctx)
+    {
+        Match(DataBlock(data, len), cb_handler, ctx);
     }
 
     void HsMatcher::SafeMatch(const std::string &data, UserCtx *ctx)
     {
-        if (!db || updated)
+        SafeMatch(DataBlock(data), cb_handler, ctx);
+    }
+
+    void HsMatcher::SafeMatch(DataBlock data, UserCtx *ctx)
+    {
+        SafeMatch(data, cb_handler, ctx);
+    }
+
+    void HsMatcher::SafeMatch(const char *data, size_t len, UserCtx *ctx)
+    {
+        SafeMatch(DataBlock(data, len), cb_handler, ctx);
+    }
+
+    ScanResult HsMatcher::Match(DataBlock data, const ScanOptions &opts, UserCtx *ctx)
+    {
+        return Match(data, opts, cb_handler, ctx);
+    }
+
+    ScanResult HsMatcher::SafeMatch(DataBlock data, const ScanOptions &opts, UserCtx *ctx)
+    {
+        return SafeMatch(data, opts, cb_handler, ctx);
+    }
+
+    void HsMatcher::Match(const DataBlock *blocks, size_t count, UserCtx *ctx)
+    {
+        ScanBlocks(blocks, count, cb_handler, ctx, false);
+    }
+
+    void HsMatcher::Match(const struct iovec *blocks, size_t count, UserCtx *ctx)
+    {
+        ScanBlocks(blocks, count, cb_handler, ctx, false);
+    }
+
+    void HsMatcher::SafeMatch(const DataBlock *blocks, size_t count, UserCtx *ctx)
+    {
+        ScanBlocks(blocks, count, cb_handler, ctx, true);
+    }
+
+    void HsMatcher::SafeMatch(const struct iovec *blocks, size_t count, UserCtx *ctx)
+    {
+        ScanBlocks(blocks, count, cb_handler, ctx, true);
+    }
+
+    size_t HsMatcher::BatchInto(const DataBlock *records, size_t count, BatchHit *hits, size_t capacity, size_t *next, bool safe)
+    {
+        if (next)
         {
-            DLogger.DLog(LogType::Warning, "generate database automatically!");
-            compile();
+            *next = 0;
+        }
+        Lease gen(*this);
+        if (!gen)
+        {
+            return 0;
         }
 
-        auto scr = scratch->GetSafeScratch();
-        ScanCtx scanctx{this->cb_handler, ctx, &this->patterns};
-        auto res = hs_scan(db, data.data(), data.size(), 0, scr, HsMatcher::callback, &scanctx);
+        size_t used = 0;
+        // the record being collected, and where its hits begin in the buffer.
+        size_t current = count;
+        size_t begin = 0;
+        auto collect = [&](size_t record, unsigned int id, unsigned long long from, unsigned long long to, const UserCtx *, const UserCtx *) -> int
+        {
+            if (record != current)
+            {
+                current = record;
+                begin = used;
+            }
+            if (used == capacity)
+            {
+                return 1;
+            }
+            hits[used++] = BatchHit{static_cast<uint32_t>(record), id, from, to};
+            return 0;
+        };
+        size_t stop = count;
+        int ret = ScanBatch(*gen, records, count, collect, nullptr, safe, &stop);
+        if (ret != HS_SUCCESS && current == stop)
+        {
+            // a record is in the buffer with all its hits or not at all.
+            used = begin;
+        }
+        if (ret == HS_SCAN_TERMINATED && !used)
+        {
+            HSCPP_DLOG(Warning, "batch hit buffer can't hold the hits of record %zu!", stop);
+        }
+        else if (ret == HS_SCAN_TERMINATED && !next)
+        {
+            HSCPP_DLOG(Warning, "batch hit buffer is full, the records from %zu on are not scanned!", stop);
+        }
+        if (next)
+        {
+            *next = stop;
+        }
+        return used;
+    }
+
+    size_t HsMatcher::MatchBatch(const DataBlock *records, size_t count, BatchHit *hits, size_t capacity, size_t *next)
+    {
+        return BatchInto(records, count, hits, capacity, next, false);
+    }
+
+    size_t HsMatcher::SafeMatchBatch(const DataBlock *records, size_t count, BatchHit *hits, size_t capacity, size_t *next)
+    {
+        return BatchInto(records, count, hits, capacity, next, true);
     }
 
-    int HsMatcher::callback(unsigned int id, unsigned long long from, unsigned long long to, unsigned int flags, void *context)
+    int HsMatcher::OnCollect(unsigned int id, unsigned long long from, unsigned long long to, unsigned int, void *context)
     {
-        ScanCtx *scanctx = reinterpret_cast<ScanCtx *>(context);
-        auto patterns = scanctx->patterns;
-        PatPtr target = nullptr;
-        for (auto &&i : *patterns)
+        HandlerCtx<ResultBuffer> *scanctx = static_cast<HandlerCtx<ResultBuffer> *>(context);
+        const PatternEntry *target = scanctx->index->Find(id);
+        if (!target)
         {
-            if (dynamic_cast<Hs_Pattern *>(i.get())->GetId() == id)
+            HSCPP_DLOG(Warning, "no pattern matched but matcher hit, check mutithread!!!");
+            return 0;
+        }
+        uint32_t slot = scanctx->index->Slot(target);
+        if (scanctx->index->Muted(slot) || !Confirmed(target, scanctx->data, scanctx->len, from, to))
+        {
+            return 0;
+        }
+        if (scanctx->hits)
+        {
+            scanctx->hits[slot].fetch_add(1, std::memory_order_relaxed);
+        }
+        return scanctx->handler->Add(slot, id, from, to);
+    }
+
+    int HsMatcher::CollectInto(DataBlock data, ResultBuffer &results, bool safe)
+    {
+        Lease gen(*this);
+        if (!gen)
+        {
+            results.clear();
+            return HS_INVALID;
+        }
+
+        if (!Fits(data.len))
+        {
+            results.clear();
+            return HS_INVALID;
+        }
+
+        results.Begin(gen->index.size());
+        StatsTimer timer(gen->stats.get(), safe ? StatsKind::safe_match : StatsKind::match, data.len);
+        HandlerCtx<ResultBuffer> scanctx{&results, nullptr, &gen->index, gen->HitRow(), data.data, data.len};
+        uint32_t slot = 0;
+        auto scr = safe ? gen->scratch->GetSafeScratch(slot) : gen->scratch->GetScratch();
+        int ret = HS_SUCCESS;
+        for (auto &&db : gen->dbs)
+        {
+            ret = hs_scan(db, data.data, static_cast<unsigned int>(data.len), 0, scr, OnCollect, &scanctx);
+            if (ret != HS_SUCCESS)
             {
-                target = i;
                 break;
             }
         }
-        if (!target)
+        if (safe)
+        {
+            gen->scratch->Release(slot);
+        }
+        if (ret == HS_SCAN_TERMINATED)
+        {
+            HSCPP_DLOG(Warning, "result buffer is full, the rest of the data is not scanned!");
+        }
+        return ret;
+    }
+
+    int HsMatcher::MatchInto(DataBlock data, ResultBuffer &results)
+    {
+        return CollectInto(data, results, false);
+    }
+
+    int HsMatcher::SafeMatchInto(DataBlock data, ResultBuffer &results)
+    {
+        return CollectInto(data, results, true);
+    }
+
+    bool HsMatcher::Captures(uint32_t id, DataBlock data, unsigned long long from, unsigned long long to, std::vector<Capture> &groups)
+    {
+        groups.clear();
+        Lease gen(*this);
+        if (!gen)
+        {
+            return false;
+        }
+        const PatternEntry *target = gen->index.Find(id);
+        if (!target || !target->confirm)
+        {
+            HSCPP_DLOG(Warning, "pattern %u is not marked for captures!", id);
+            return false;
+        }
+        return target->confirm->Extract(data.data, data.len, from, to, groups);
+    }
+
+    size_t HsMatcher::DatabaseSize()
+    {
+        auto gen = Acquire();
+        if (!gen)
         {
-            DLogger.DLog(LogType::Warning, "no pattern matched but matcher hit, check mutithread!!!");
             return 0;
         }
-        return scanctx->cb_handler(id, from, to, scanctx->ctx, dynamic_cast<Hs_Pattern *>(target.get())->GetUerCtx());
+        size_t total = 0;
+        for (auto &&db : gen->dbs)
+        {
+            size_t size = 0;
+            if (hs_database_size(db, &size) == HS_SUCCESS)
+            {
+                total += size;
+            }
+        }
+        return total;
+    }
+
+    size_t HsMatcher::ScratchSize()
+    {
+        auto gen = Acquire();
+        size_t size = 0;
+        if (!gen || hs_scratch_size(gen->scratch->GetScratch(), &size) != HS_SUCCESS)
+        {
+            return 0;
+        }
+        return size;
+    }
+
+    size_t HsMatcher::StreamSize()
+    {
+        auto gen = Acquire();
+        if (!gen || !(gen->mode & HS_MODE_STREAM))
+        {
+            return 0;
+        }
+        size_t total = 0;
+        for (auto &&db : gen->dbs)
+        {
+            size_t size = 0;
+            if (hs_stream_size(db, &size) == HS_SUCCESS)
+            {
+                total += size;
+            }
+        }
+        return total;
+    }
+
+    void HsMatcher::EnableStats(bool enable)
+    {
+        stats->Enable(enable);
+    }
+
+    StatsSnapshot HsMatcher::Stats()
+    {
+        return stats->Snapshot();
+    }
+
+    std::string HsMatcher::StatsText(const std::string &prefix)
+    {
+        return stats->Prometheus(prefix);
+    }
+
+    int HsMatcher::WriteStats(const std::string &path, const std::string &prefix)
+    {
+        std::string tmp = path + ".tmp";
+        FILE *file = fopen(tmp.c_str(), "w");
+        if (!file)
+        {
+            HSCPP_DLOG(Error, "open %s failed!", tmp.c_str());
+            return HS_INVALID;
+        }
+        auto text = StatsText(prefix);
+        bool ok = fwrite(text.data(), 1, text.size(), file) == text.size();
+        ok = fclose(file) == 0 && ok;
+        if (!ok || rename(tmp.c_str(), path.c_str()))
+        {
+            HSCPP_DLOG(Error, "write stats to %s failed!", path.c_str());
+            remove(tmp.c_str());
+            return HS_INVALID;
+        }
+        return HS_SUCCESS;
     }
 
-}
\ No newline at end of file
+}
@@ -28,11 +28,29 @@
  */
 
 #include "matcher.h"
+#include "pattern_index.h"
+#include "compile_cache.h"
+#include "hs_stats.h"
+#include "scan_budget.h"
+#include "result_buffer.h"
+#include "pattern_confirm.h"
+#include "pattern_profile.h"
+#include "file_ctx.h"
 #include <hs/hs.h>
 #include <vector>
 #include <functional>
 #include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <unordered_map>
 #include <memory>
+#include <limits>
+#include <type_traits>
+#include <utility>
+#include <sys/uio.h>
+#include <string.h>
 
 namespace Echidna
 {
@@ -41,7 +59,7 @@ namespace Echidna
      */
     static MatchCb defaultcb = [](unsigned int, unsigned long long from, unsigned long long to, const UserCtx *m_ctx, const UserCtx *p_ctx) -> int
     {
-        DLogger.DLog(LogType::Info, "Matcher hit at <pos> " + std::to_string(to));
+        HSCPP_DLOG(Info, "Matcher hit at <pos> %llu", to);
         return 0;
     };
 
@@ -53,47 +71,196 @@ namespace Echidna
         return pat1.GetId() == pat2.GetId();
     }
 
+    /**
+     * handlers are callables with the signature of @ref MatchCb, so that Match(data, nullptr) still means
+     * no context and Match(data, len) still means a length.
+     */
+    template <typename F>
+    using EnableIfHandler = decltype(std::declval<F &>()(0u, 0ull, 0ull, static_cast<const UserCtx *>(nullptr),
+                                                         static_cast<const UserCtx *>(nullptr)),
+                                     void());
+
+    /**
+     * batch handlers take the index of the record first, see @ref HsMatcher::MatchBatch().
+     */
+    template <typename F>
+    using EnableIfBatchHandler = decltype(std::declval<F &>()(size_t(0), 0u, 0ull, 0ull, static_cast<const UserCtx *>(nullptr),
+                                                              static_cast<const UserCtx *>(nullptr)),
+                                          void());
+
+    struct DataBlock;
+
+    /**
+     * vectored scans take arrays of @ref DataBlock or struct iovec.
+     */
+    template <typename Block>
+    using EnableIfBlock = typename std::enable_if<std::is_same<Block, DataBlock>::value || std::is_same<Block, struct iovec>::value>::type;
+
+    /**
+     * NUL-terminated strings are taken by a template, so that Match(data, 0) picks the overload with a
+     * length rather than a null context.
+     */
+    template <typename C>
+    using EnableIfChar = typename std::enable_if<std::is_same<C, char>::value>::type;
+
+    /**
+     * a view of data to scan, it does not own the data. It is used for one scan, or as one block of a
+     * vectored scan.
+     *
+     * It can be implicit constructed by const char*, std::string, and any string_view-like type that has
+     * data() and size(), so no copy is made to scan mmap'd files, network buffers and so on.
+     */
+    struct DataBlock
+    {
+        const char *data;
+        size_t len;
+
+        DataBlock() : data(nullptr), len(0) {}
+        DataBlock(const char *udata, size_t ulen) : data(udata), len(ulen) {}
+        DataBlock(const char *str) : data(str), len(str ? strlen(str) : 0) {}
+        template <typename T, typename = decltype(std::declval<const T &>().data()), typename = decltype(std::declval<const T &>().size())>
+        DataBlock(const T &view) : data(view.data()), len(view.size()) {}
+    };
+
+    /**
+     * one hit of a batch scan, see @ref HsMatcher::MatchBatch().
+     */
+    struct BatchHit
+    {
+        // index of the record in the batch.
+        uint32_t record;
+        uint32_t id;
+        unsigned long long from;
+        unsigned long long to;
+    };
+
+    /**
+     * the default upper bound of scratches a @ref Scratch pool clones.
+     */
+    constexpr static uint32_t SCRATCH_POOL_MAX = 256;
+
     /**
      * it contains the scratch data that hyperscan needs, generally users don't need to care it.
+     * Each one is padded to the size of a cache line, so threads using neighbouring slots rarely share one.
      */
     struct ScratchData
     {
         hs_scratch_t *scr;
-        std::mutex mtx;
-        bool in_use;
+        std::atomic<bool> in_use;
+        // whether the slot is in the free list.
+        std::atomic<bool> listed;
+        // slot + 1 of the next free slot, 0 means the end of the list.
+        std::atomic<uint32_t> next;
+        char pad[48];
         ScratchData()
-        {
-            scr = nullptr;
-            in_use = false;
-        }
-        ScratchData(const ScratchData &data)
-        {
-            scr = data.scr;
-            in_use = data.in_use;
-        }
+            : scr(nullptr), in_use(false), listed(false), next(0) {}
     };
 
     /**
-     * it implement a thread-safe scratch, generally users don't need to care it.
+     * it implement a thread-safe scratch pool, generally users don't need to care it.
+     *
+     * GetSafeScratch() first tries the slot the calling thread used last time on this pool, then pops the
+     * lock-free free list, and clones a new scratch only if both fail. The pool never grows over its
+     * maximum size: callers wait a little for a release then, and get a temporary scratch of their own
+     * (slot @ref SPARE_SLOT) if none comes, so a scan from inside a callback can't wait forever. A spare
+     * is freed by the Release() on the same thread. Release() is O(1) by slot.
      */
     class Scratch
     {
     public:
+        constexpr static uint32_t SPARE_SLOT = std::numeric_limits<uint32_t>::max();
+
         Scratch() = delete;
-        Scratch(hs_database_t *db);
-        hs_scratch_t *GetSafeScratch();
+        Scratch(const Scratch &) = delete;
+        Scratch &operator=(const Scratch &) = delete;
+        Scratch(hs_database_t *db, uint32_t max_size = SCRATCH_POOL_MAX);
+        /**
+         * one scratch pool that is valid for all the given databases, e.g. the shards of one matcher.
+         */
+        Scratch(const std::vector<hs_database_t *> &dbs, uint32_t max_size = SCRATCH_POOL_MAX);
+        hs_scratch_t *GetSafeScratch(uint32_t &slot);
         hs_scratch_t *GetScratch();
-        void Release(hs_scratch_t *scr);
+        void Release(uint32_t slot);
+        /**
+         * a new scratch outside the pool for a thread to keep, the caller frees it with hs_free_scratch.
+         */
+        hs_scratch_t *Clone();
         ~Scratch();
 
     private:
-        ScratchData prototype;
-        std::mutex PoolMtx;
-        std::vector<ScratchData> ScrPool;
+        void Alloc(hs_database_t *db);
+        bool TryTake(uint32_t slot);
+        void Push(uint32_t slot);
+        bool Pop(uint32_t &slot);
+
+        hs_scratch_t *prototype;
+        // unique per pool, it tells the thread-local cached slot belongs to this pool.
+        uint64_t generation;
+        uint32_t capacity;
+        std::atomic<uint32_t> size;
+        std::unique_ptr<ScratchData[]> ScrPool;
+        // (tag << 32) | (slot + 1) of the first free slot, the tag avoids ABA.
+        std::atomic<uint64_t> free_head;
+    };
+
+    /**
+     * one compiled generation of a matcher, generally users don't need to care it.
+     *
+     * It holds the databases (one per shard) together with the patterns they were compiled from, their index
+     * and a scratch pool valid for all of them. A generation never changes once it is published, and it is
+     * freed when the last scan or stream using it finishes, and the threads that scanned with it have
+     * moved on to a newer one.
+     */
+    struct HsDatabase
+    {
+        std::vector<hs_database_t *> dbs;
+        uint32_t mode;
+        uint64_t version;
+        std::vector<PatPtr> patterns;
+        std::vector<PatternStorePtr> stores;
+        PatternIndex index;
+        // regexes of the prefilter and capture patterns, the index points to them.
+        std::vector<std::unique_ptr<PatternConfirm>> confirms;
+        std::unique_ptr<Scratch> scratch;
+        // the longest match of all patterns, computed by the first parallel match. UINT_MAX means the
+        // data can't be scanned in chunks, e.g. a pattern is unbounded.
+        std::once_flag width_once;
+        unsigned int max_width;
+        // the stats of the matcher, hit counters are allocated by the first scan that counts.
+        HsStatsPtr stats;
+        std::once_flag hits_once;
+        std::unique_ptr<HitCounters> hits;
+        HsDatabase() : mode(0), version(0), max_width(0) {}
+        ~HsDatabase();
+
+        /**
+         * the hit counters of the calling thread, or nullptr if stats are disabled.
+         */
+        inline std::atomic<uint64_t> *HitRow()
+        {
+            if (!stats || !stats->Enabled())
+            {
+                return nullptr;
+            }
+            std::call_once(hits_once, [this]
+                           { InitHits(); });
+            return hits->counts.get() + static_cast<size_t>(HsStats::Shard()) * hits->stride;
+        }
+
+    private:
+        void InitHits();
     };
 
+    using HsDatabasePtr = std::shared_ptr<HsDatabase>;
+
+    class HsStream;
+
     /**
      * it implement the hyperscan matcher, generally users only need to use the interfaces inside.
+     *
+     * Changing patterns or modes never blocks scans: the database is recompiled on a background thread and
+     * swapped in atomically when it is ready, scans in flight keep using the one they started with.
+     * Only the very first scan waits for a database, since there is nothing to scan with before.
      */
     class HsMatcher : public Matcher
     {
@@ -119,6 +286,33 @@ namespace Echidna
             vector = HS_MODE_VECTORED
         };
 
+        /**
+         * how patterns are split into shards, see @ref SetShards().
+         */
+        enum class ShardPolicy
+        {
+            /**
+             * the same number of patterns in every shard, in the order they were added.
+             */
+            count,
+
+            /**
+             * balance the estimated compile cost of every shard, e.g. long expressions and repeats cost more.
+             */
+            complexity,
+
+            /**
+             * keep patterns with the same flags in the same shard, then balance the number of patterns.
+             */
+            flag,
+
+            /**
+             * put every pattern in a shard chosen by its id, so adding or removing a pattern only changes
+             * its own shard. Use it with @ref SetCompileCache().
+             */
+            stable
+        };
+
         enum class LeftMatchFlag
         {
             /**
@@ -187,6 +381,15 @@ namespace Echidna
          */
         void push_back(const std::string &);
 
+        /**
+         * Add all patterns of a store at once, the store is moved into the matcher and not copied. It is the
+         * way to load very large pattern sets, see @ref PatternStore.
+         *
+         * @ref erase(uint32_t) and @ref find() work on its patterns too, @ref find() returns a copy of the
+         * pattern without its user-context.
+         */
+        void push_back(PatternStore &&store);
+
         /**
          * Remove a regex pattern to the matcher.
          *
@@ -227,6 +430,28 @@ namespace Echidna
          */
         PatPtr find(uint32_t id);
 
+        /**
+         * Drop the hits of a pattern before they reach the callback, without compiling again. It takes
+         * effect at once for every match, stream and flow table of the matcher and is safe while other
+         * threads scan. A disabled pattern stays disabled in databases compiled later.
+         *
+         * @return false if the pattern is not in a compiled database yet, it is disabled anyway when it is.
+         */
+        bool Disable(uint32_t id);
+
+        /**
+         * Undo @ref Disable(), it returns false if the pattern was not disabled.
+         */
+        bool Enable(uint32_t id);
+
+        bool IsDisabled(uint32_t id);
+
+        /**
+         * Remove patterns that stayed disabled for the given time from the matcher, the background thread
+         * compiles without them. 0 (the default) keeps disabled patterns until they are enabled or erased.
+         */
+        void SetCompaction(std::chrono::seconds after);
+
         /**
          * pass in a std::function, and it will be called when the matcher hits.
          *
@@ -237,7 +462,8 @@ namespace Echidna
         void RegisteCb(MatchCb cb = defaultcb);
 
         /**
-         * set hyperscan database mode,
+         * set hyperscan database mode, it replaces the previous mode and the database will be recompiled.
+         * A streaming database is scanned with @ref HsStream.
          *
          * @param mode
          *      @ref Echidna::MatchMode
@@ -253,11 +479,75 @@ namespace Echidna
         void SetMatchFlag(LeftMatchFlag flag);
 
         /**
-         *  Compile hyperscan database. It will be automatically called.
-         *  You can call it manually too.
+         * Split patterns into shards that are compiled concurrently, each one into its own database. All shards
+         * are scanned by every match as one matcher and report the same ids, but hits of different shards are
+         * not ordered by offset between each other. More shards compile faster, fewer shards scan faster.
+         * Logical combinations can't be split, so a matcher with any combination pattern uses one shard.
+         *
+         * @param shards
+         *      number of shards, 1 (the default) compiles one database.
+         * @param policy
+         *      how patterns are split, @ref ShardPolicy.
+         */
+        void SetShards(uint32_t shards, ShardPolicy policy = ShardPolicy::count);
+
+        /**
+         * number of shards of the database in use, 0 if there is none.
+         */
+        uint32_t ShardCount();
+
+        /**
+         * Reuse compiled shards whose patterns, flags, extended parameters and mode have not changed, instead of
+         * compiling them again. With @ref ShardPolicy::stable, a small change of a large pattern set only
+         * compiles the shards it touches. One cache can be shared by several matchers.
+         *
+         * @param cache
+         *      the cache to use, or nullptr to compile everything every time.
+         */
+        void SetCompileCache(CompileCachePtr cache);
+
+        /**
+         * Also compile regex patterns that have no regex syntax at all, e.g. "evil\\.example\\.com", as literals
+         * (see @ref Hs_Pattern::SetLiteral()). Large feeds of plain strings then compile in a fraction of the
+         * time and memory. Literals and regex are scanned together and report the same ids, but a matcher with
+         * any logical combination compiles everything as regex. Off by default.
+         */
+        void SetLiteralDetect(bool detect);
+
+        /**
+         *  Compile hyperscan database and use it for the next scans. It will be automatically called on a
+         *  background thread after patterns or modes change. You can call it manually too, it compiles in
+         *  the calling thread.
          */
         int compile();
 
+        /**
+         * Wait until all the changes made before are compiled and used by the next scans.
+         */
+        void Sync();
+
+        /**
+         * Save the compiled database together with its patterns to a file, so that another process can
+         * @ref Load() it instead of compiling again. The database will be compiled first if needed.
+         * User-contexts of patterns are not saved.
+         *
+         * @param path
+         *      the file to write, it is replaced atomically.
+         * @return HS_SUCCESS or a hyperscan error code.
+         */
+        int Save(const std::string &path);
+
+        /**
+         * Load a database saved by @ref Save(), it replaces all patterns, the mode and the database of the
+         * matcher. The file is mapped read-only, and it is rejected if it was written by another file format,
+         * hyperscan version or platform.
+         *
+         * @param path
+         *      the file to read.
+         * @return HS_SUCCESS or a hyperscan error code.
+         */
+        int Load(const std::string &path);
+
         /**
          * Match the given string with the matcher. If hit, default or registed callback function
          * will be called.It has almost no performance loss, but it is not thread safe as well as hyperscan
@@ -281,13 +571,900 @@ namespace Echidna
          */
         void SafeMatch(const std::string &data, UserCtx *ctx = nullptr);
 
+        /**
+         * Same as @ref Match(const std::string &, UserCtx *), but scan the given buffer in place.
+         *
+         * @param data
+         *      the data to scan, see @ref DataBlock.
+         * @param ctx
+         *      it will be passed to the callback function if hit.
+         */
+        void Match(DataBlock data, UserCtx *ctx = nullptr);
+        void Match(const char *data, size_t len, UserCtx *ctx = nullptr);
+
+        template <typename C, typename = EnableIfChar<C>>
+        void Match(const C *data, UserCtx *ctx = nullptr)
+        {
+            Match(DataBlock(data), ctx);
+        }
+
+        /**
+         * Same as @ref SafeMatch(const std::string &, UserCtx *), but scan the given buffer in place.
+         */
+        void SafeMatch(DataBlock data, UserCtx *ctx = nullptr);
+        void SafeMatch(const char *data, size_t len, UserCtx *ctx = nullptr);
+
+        template <typename C, typename = EnableIfChar<C>>
+        void SafeMatch(const C *data, UserCtx *ctx = nullptr)
+        {
+            SafeMatch(DataBlock(data), ctx);
+        }
+
+        /**
+         * Match the given data with the matcher, and call the given handler if hit.
+         * The handler is called directly from the hyperscan callback, so it can be inlined and there is no
+         * std::function copy per scan. Same as @ref Match(), it is not thread safe.
+         *
+         * @param data
+         *      the data to scan, see @ref DataBlock.
+         * @param handler
+         *      any callable with the same signature as @ref MatchCb.
+         * @param ctx
+         *      it will be passed to the handler if hit.
+         */
+        template <typename F, typename = EnableIfHandler<F>>
+        void Match(DataBlock data, F &&handler, UserCtx *ctx = nullptr)
+        {
+            Lease gen(*this);
+            if (!gen)
+            {
+                return;
+            }
+            ScanData(*gen, data, handler, ctx, false);
+        }
+
+        template <typename F, typename = EnableIfHandler<F>>
+        void Match(const char *data, size_t len, F &&handler, UserCtx *ctx = nullptr)
+        {
+            Match(DataBlock(data, len), handler, ctx);
+        }
+
+        /**
+         * Match the given data with the matcher, and call the given handler if hit.
+         * Same as @ref SafeMatch(), it is thread safe.
+         *
+         * @param data
+         *      the data to scan, see @ref DataBlock.
+         * @param handler
+         *      any callable with the same signature as @ref MatchCb.
+         * @param ctx
+         *      it will be passed to the handler if hit.
+         */
+        template <typename F, typename = EnableIfHandler<F>>
+        void SafeMatch(DataBlock data, F &&handler, UserCtx *ctx = nullptr)
+        {
+            Lease gen(*this);
+            if (!gen)
+            {
+                return;
+            }
+            ScanData(*gen, data, handler, ctx, true);
+        }
+
+        template <typename F, typename = EnableIfHandler<F>>
+        void SafeMatch(const char *data, size_t len, F &&handler, UserCtx *ctx = nullptr)
+        {
+            SafeMatch(DataBlock(data, len), handler, ctx);
+        }
+
+        /**
+         * Match the given data within limits: the scan stops at the first hit, after some hits, after a hit
+         * of given patterns, or when it takes too long or the data is too long, see @ref ScanOptions. A
+         * "does anything match?" query with max_hits 1 stops at the first hit instead of scanning all data.
+         * Same as @ref Match(), it is not thread safe.
+         *
+         * @return what the scan did and why it stopped, see @ref ScanResult.
+         */
+        ScanResult Match(DataBlock data, const ScanOptions &opts, UserCtx *ctx = nullptr);
+
+        /**
+         * Same as @ref Match(DataBlock, const ScanOptions &, UserCtx *), but it is thread safe.
+         */
+        ScanResult SafeMatch(DataBlock data, const ScanOptions &opts, UserCtx *ctx = nullptr);
+
+        /**
+         * @ref Match() within limits that calls the given handler if hit.
+         */
+        template <typename F, typename = EnableIfHandler<F>>
+        ScanResult Match(DataBlock data, const ScanOptions &opts, F &&handler, UserCtx *ctx = nullptr)
+        {
+            Lease gen(*this);
+            if (!gen)
+            {
+                return ScanResult{HS_INVALID, StopReason::error, 0, 0};
+            }
+            return ScanLimited(*gen, data, opts, handler, ctx, false);
+        }
+
+        /**
+         * @ref SafeMatch() within limits that calls the given handler if hit.
+         */
+        template <typename F, typename = EnableIfHandler<F>>
+        ScanResult SafeMatch(DataBlock data, const ScanOptions &opts, F &&handler, UserCtx *ctx = nullptr)
+        {
+            Lease gen(*this);
+            if (!gen)
+            {
+                return ScanResult{HS_INVALID, StopReason::error, 0, 0};
+            }
+            return ScanLimited(*gen, data, opts, handler, ctx, true);
+        }
+
+        /**
+         * Match the given blocks as one piece of data without joining them, the matcher must be set to
+         * @ref HsMatcher::MatchMode::vector. Offsets of hits are counted across all the blocks.
+         * Same as @ref Match(), it is not thread safe.
+         *
+         * @param blocks
+         *      the blocks to scan, in order.
+         * @param count
+         *      number of blocks.
+         * @param ctx
+         *      it will be passed to the callback function if hit.
+         */
+        void Match(const DataBlock *blocks, size_t count, UserCtx *ctx = nullptr);
+        void Match(const struct iovec *blocks, size_t count, UserCtx *ctx = nullptr);
+
+        /**
+         * Same as vectored @ref Match(), but it is thread safe.
+         */
+        void SafeMatch(const DataBlock *blocks, size_t count, UserCtx *ctx = nullptr);
+        void SafeMatch(const struct iovec *blocks, size_t count, UserCtx *ctx = nullptr);
+
+        /**
+         * Vectored @ref Match() that calls the given handler if hit.
+         */
+        template <typename Block, typename F, typename = EnableIfHandler<F>, typename = EnableIfBlock<Block>>
+        void Match(const Block *blocks, size_t count, F &&handler, UserCtx *ctx = nullptr)
+        {
+            ScanBlocks(blocks, count, handler, ctx, false);
+        }
+
+        /**
+         * Vectored @ref SafeMatch() that calls the given handler if hit.
+         */
+        template <typename Block, typename F, typename = EnableIfHandler<F>, typename = EnableIfBlock<Block>>
+        void SafeMatch(const Block *blocks, size_t count, F &&handler, UserCtx *ctx = nullptr)
+        {
+            ScanBlocks(blocks, count, handler, ctx, true);
+        }
+
+        /**
+         * Match many small records, e.g. messages or packets, in one call. The database and the scratch are
+         * acquired once for the whole batch, and the records are scanned one by one in a tight loop.
+         * Same as @ref Match(), it is not thread safe.
+         *
+         * @param records
+         *      the records to scan, each one is scanned on its own.
+         * @param count
+         *      number of records.
+         * @param handler
+         *      any callable like int(size_t record, unsigned int id, unsigned long long from,
+         *      unsigned long long to, const UserCtx *match_ctx, const UserCtx *pat_ctx), record is the index
+         *      of the record that hits. Returning non-zero stops the whole batch.
+         * @param ctxs
+         *      nullptr, or one context per record, passed to the handler as match_ctx.
+         * @return HS_SUCCESS, HS_SCAN_TERMINATED if the handler asked to stop, or a hyperscan error code.
+         */
+        template <typename F, typename = EnableIfBatchHandler<F>>
+        int MatchBatch(const DataBlock *records, size_t count, F &&handler, UserCtx *const *ctxs = nullptr)
+        {
+            Lease gen(*this);
+            if (!gen)
+            {
+                return HS_INVALID;
+            }
+            return ScanBatch(*gen, records, count, handler, ctxs, false);
+        }
+
+        /**
+         * Same as @ref MatchBatch(), but it is thread safe.
+         */
+        template <typename F, typename = EnableIfBatchHandler<F>>
+        int SafeMatchBatch(const DataBlock *records, size_t count, F &&handler, UserCtx *const *ctxs = nullptr)
+        {
+            Lease gen(*this);
+            if (!gen)
+            {
+                return HS_INVALID;
+            }
+            return ScanBatch(*gen, records, count, handler, ctxs, true);
+        }
+
+        /**
+         * Match many small records, and write the hits to a preallocated buffer instead of calling back.
+         * Nothing is allocated per scan. If the buffer fills up, the batch stops at the record that didn't
+         * fit, and the hits of that record are taken back, so the buffer holds all the hits of the records
+         * before it and the batch can go on from there.
+         *
+         * @param hits
+         *      the buffer to write, hits are in order of record.
+         * @param capacity
+         *      number of hits the buffer can hold.
+         * @param next
+         *      if not nullptr, it is set to the index of the first record whose hits are not in the buffer,
+         *      count if the whole batch was scanned. Go on with records + *next once the hits are handled.
+         *      If 0 hits are written and *next < count, that record alone has more hits than capacity.
+         * @return number of hits written.
+         */
+        size_t MatchBatch(const DataBlock *records, size_t count, BatchHit *hits, size_t capacity, size_t *next = nullptr);
+
+        /**
+         * Same as @ref MatchBatch(const DataBlock *, size_t, BatchHit *, size_t, size_t *), but it is thread
+         * safe.
+         */
+        size_t SafeMatchBatch(const DataBlock *records, size_t count, BatchHit *hits, size_t capacity, size_t *next = nullptr);
+
+        /**
+         * Match the given data, and collect the hits into a reusable buffer instead of calling back. The
+         * buffer is cleared first, and no memory is allocated unless it has to grow, see @ref ResultBuffer.
+         * Hits are in the order hyperscan reports them, shard by shard. Same as @ref Match(), it is not
+         * thread safe.
+         *
+         * @return HS_SUCCESS, HS_SCAN_TERMINATED if the buffer filled up with @ref ResultBuffer::Overflow::stop,
+         * or a hyperscan error code.
+         */
+        int MatchInto(DataBlock data, ResultBuffer &results);
+
+        /**
+         * Same as @ref MatchInto(), but it is thread safe.
+         */
+        int SafeMatchInto(DataBlock data, ResultBuffer &results);
+
+        /**
+         * Pull the capture groups out of a hit of a pattern marked with @ref Hs_Pattern::SetCapture() or
+         * compiled with the prefilter flag. Hyperscan doesn't report captures, so a backtracking regex runs
+         * on the data before the hit: call it from the handler, only for the hits whose fields are needed.
+         *
+         * Prefilter patterns match what hyperscan can't compile, e.g. back references, and their hits are
+         * confirmed by the same regex before the handler sees them in block and batch scans. Streams and
+         * vectored scans have no data to check against, and pass the candidate hits as they are.
+         * It is thread safe.
+         *
+         * @param data
+         *      the data that was scanned, offsets are counted from its start.
+         * @param from
+         *      the start offset of the hit, it narrows the search for patterns with the leftmost flag.
+         * @param to
+         *      the end offset of the hit.
+         * @param groups
+         *      the groups of the match, group 0 is the whole match.
+         * @return false if the pattern has no regex, or it doesn't match there.
+         */
+        bool Captures(uint32_t id, DataBlock data, unsigned long long from, unsigned long long to, std::vector<Capture> &groups);
+
+        /**
+         * Set how far back from the end of a hit the regex of a prefilter or capture pattern may search,
+         * see @ref Captures(). std::regex is slow and recursive on long inputs, so a pattern that may match
+         * further back, e.g. one with ".*", is only searched in the window. 1KB by default.
+         *
+         * Prefilter hits can only be confirmed in block mode, a prefilter pattern fails the compile of a
+         * stream or vector mode matcher.
+         *
+         * @param pass
+         *      a prefilter hit that isn't found in the window is passed unconfirmed if true (the default),
+         *      or dropped. It also decides the hits of a prefilter pattern std::regex can't take at all, e.g.
+         *      with a lookbehind: they are passed unconfirmed, or the compile fails.
+         */
+        void SetConfirmWindow(size_t window, bool pass = true);
+
+        /**
+         * Match one large buffer, e.g. a multi-GB dump or mmap'd file, on several threads. The buffer is split
+         * into chunks that overlap by the longest match of the patterns, so every hit is found in one chunk
+         * and reported once, with offsets counted from the start of the buffer. Hits are reported on the
+         * calling thread chunk by chunk, in order, as soon as a chunk and the ones before it are scanned.
+         * When the callback asks to stop, chunks that are not scanned yet are skipped.
+         *
+         * If a pattern has no longest match (e.g. "a.*b"), is a logical combination, a single match or has
+         * offset limits, the buffer can't be split. A streaming matcher then scans it as one stream, in
+         * pieces of up to 4GB, and a block matcher in one piece, which fails with HS_INVALID over 4GB.
+         * It is thread safe.
+         *
+         * @param data
+         *      the data to scan, see @ref DataBlock.
+         * @param threads
+         *      number of threads to scan with, 0 means one per hardware thread.
+         * @param ctx
+         *      it will be passed to the callback function if hit.
+         * @return HS_SUCCESS, HS_SCAN_TERMINATED if the callback asked to stop, or a hyperscan error code.
+         */
+        int ParallelMatch(DataBlock data, uint32_t threads = 0, UserCtx *ctx = nullptr);
+
+        /**
+         * @ref ParallelMatch() that calls the given handler if hit, it is only called on the calling thread.
+         */
+        template <typename F, typename = EnableIfHandler<F>>
+        int ParallelMatch(DataBlock data, uint32_t threads, F &&handler, UserCtx *ctx = nullptr)
+        {
+            Lease gen(*this);
+            if (!gen)
+            {
+                return HS_INVALID;
+            }
+
+            auto deliver = [&](const std::vector<ChunkHit> &chunk) -> bool
+            {
+                for (auto &&hit : chunk)
+                {
+                    const PatternEntry *target = gen->index.Find(hit.id);
+                    if (target && !gen->index.Muted(gen->index.Slot(target)) && handler(hit.id, hit.from, hit.to, ctx, target->ctx))
+                    {
+                        return true;
+                    }
+                }
+                return false;
+            };
+            int ret = HS_SUCCESS;
+            if (ScanChunks(*gen, data, threads, deliver, ret))
+            {
+                return ret;
+            }
+            if (gen->mode & HS_MODE_STREAM)
+            {
+                return ScanPieces(*gen, data, handler, ctx);
+            }
+            return ScanData(*gen, data, handler, ctx, true);
+        }
+
+        /**
+         * Match a file without reading it into memory: it is mapped read-only and scanned in place.
+         * The callback function gets a @ref FileCtx as match_ctx, that tells the file and holds ctx.
+         *
+         * With a streaming matcher, files larger than the threshold of @ref SetFileWindow() are mapped and
+         * scanned window by window, so a file of any size only maps one window at a time. Otherwise a
+         * file is scanned in one piece, that can't be larger than 4GB. It is thread safe.
+         *
+         * WARNING: if a mapped file is truncated while it is scanned, e.g. a log that is rotated or rewritten
+         * in place, reading the pages past its new end raises SIGBUS and kills the process. Files that may
+         * shrink should be read instead, see @ref SetFileRead().
+         *
+         * @param path
+         *      the file to scan.
+         * @param ctx
+         *      it will be passed to the callback function in @ref FileCtx if hit.
+         * @return HS_SUCCESS, HS_SCAN_TERMINATED if the callback asked to stop, or a hyperscan error code.
+         */
+        int MatchFile(const std::string &path, UserCtx *ctx = nullptr);
+
+        /**
+         * Same as @ref MatchFile(const std::string &, UserCtx *), but call the given handler if hit.
+         */
+        int MatchFile(const std::string &path, MatchCb handler, UserCtx *ctx = nullptr);
+
+        /**
+         * Match every regular file under a directory, recursively, on several threads. Symbolic links
+         * are not followed. The callback function is called from all the threads, it gets a @ref FileCtx as
+         * match_ctx like @ref MatchFile(). A callback asking to stop only stops its file.
+         *
+         * @param dir
+         *      the directory to scan.
+         * @param threads
+         *      number of threads to scan with, 0 means one per hardware thread.
+         * @param ctx
+         *      it will be passed to the callback function in @ref FileCtx if hit.
+         * @return HS_SUCCESS, or the error of the last file that failed.
+         */
+        int MatchTree(const std::string &dir, uint32_t threads = 0, UserCtx *ctx = nullptr);
+
+        /**
+         * Same as @ref MatchTree(const std::string &, uint32_t, UserCtx *), but call the given handler if hit.
+         */
+        int MatchTree(const std::string &dir, uint32_t threads, MatchCb handler, UserCtx *ctx = nullptr);
+
+        /**
+         * set how @ref MatchFile() scans large files with a streaming matcher.
+         *
+         * @param threshold
+         *      files larger than it are scanned window by window, 1GB by default. Files over 4GB always are.
+         * @param window
+         *      bytes to map and scan at a time, rounded up to pages, 64MB by default.
+         */
+        void SetFileWindow(size_t threshold, size_t window);
+
+        /**
+         * set whether @ref MatchFile() and @ref MatchTree() read files with pread() into a buffer instead of
+         * mapping them. It copies the data, but a file truncated meanwhile only ends the scan early, where a
+         * mapped one raises SIGBUS. A file is read window by window like it is mapped, so a non-streaming
+         * matcher reads a whole file into memory. Off by default.
+         */
+        void SetFileRead(bool read) { file_read = read; }
+
+        /**
+         * bytes of the compiled databases of all shards, 0 if there is none.
+         */
+        size_t DatabaseSize();
+
+        /**
+         * bytes of one scratch, every thread scanning at the same time needs one.
+         */
+        size_t ScratchSize();
+
+        /**
+         * bytes of the state of one stream of all shards, 0 if the matcher is not in stream mode.
+         */
+        size_t StreamSize();
+
+        /**
+         * Measure what every pattern costs, to find the rules that slow down the database before they reach
+         * production. Each pattern, or group of patterns, is compiled and scanned on its own, in the mode of
+         * the matcher: compile time, database size, stream state size, and scan time and hits on a sample
+         * corpus, next to the same for the whole set. A rule that costs a lot alone costs a lot in the set.
+         *
+         * It compiles every pattern once more and takes a while for large sets, it doesn't touch the
+         * database being scanned. Logical combinations can't be measured alone and are left out.
+         *
+         * @param result
+         *      the costs, ranked, see @ref ProfileReport() to print them.
+         * @return HS_SUCCESS, or HS_INVALID if there is no pattern.
+         */
+        int Profile(const ProfileOptions &opts, ProfileResult &result);
+
+        /**
+         * Start or stop counting: scans, bytes and latency of @ref Match(), @ref SafeMatch(), streams and
+         * compiles, and hits of every pattern. It is disabled by default, and costs almost nothing then.
+         */
+        void EnableStats(bool enable = true);
+
+        /**
+         * everything counted since stats were first enabled.
+         */
+        StatsSnapshot Stats();
+
+        /**
+         * @ref Stats() in the Prometheus text exposition format, to be served by an endpoint.
+         */
+        std::string StatsText(const std::string &prefix = "hscpp");
+
+        /**
+         * write @ref StatsText() to a file, it is replaced atomically so a collector never reads half of it.
+         *
+         * @return HS_SUCCESS or HS_INVALID if the file can't be written.
+         */
+        int WriteStats(const std::string &path, const std::string &prefix = "hscpp");
+
     private:
-        bool updated;
-        uint32_t compile_mode;
-        hs_database_t *db;
+        friend class HsStream;
+        friend class HsFlowTable;
+        friend class HsScanEngine;
+
+        // blocks up to this count are passed to hyperscan from the stack.
+        constexpr static size_t VECTOR_STACK_BLOCKS = 64;
+        // the longest piece of data one hyperscan call takes.
+        constexpr static size_t STREAM_PIECE = std::numeric_limits<unsigned int>::max();
+
+        /**
+         * everything but the patterns that a compile depends on.
+         */
+        struct CompileOptions
+        {
+            uint32_t mode;
+            uint32_t shards;
+            ShardPolicy policy;
+            CompileCachePtr cache;
+            bool detect_literals;
+            // see SetConfirmWindow().
+            size_t confirm_window;
+            bool confirm_pass;
+        };
+
+        CompileOptions options;
+        // patterns added by stores, copied on write since generations share them.
+        std::vector<PatternStorePtr> stores;
         MatchCb cb_handler;
-        static int callback(unsigned int id, unsigned long long from, unsigned long long to, unsigned int flags, void *context);
-        std::shared_ptr<Scratch> scratch;
+        std::atomic<size_t> file_threshold;
+        std::atomic<size_t> file_window;
+        std::atomic<bool> file_read;
+        HsStatsPtr stats;
+
+        // the published generation, it is only read and written with std::atomic_load/atomic_store.
+        HsDatabasePtr current;
+        // bumped from a global counter after every publish, so it is unique across matchers. Threads keep
+        // the generation they scanned with last and only load current again when it changes.
+        std::atomic<uint64_t> epoch;
+
+        // mtx guards patterns, stores, options, the disabled patterns and the versions below. Every change
+        // bumps requested, attempted is the latest version compiled (or failed), published the latest one in use.
+        std::mutex mtx;
+        uint64_t requested;
+        uint64_t attempted;
+        uint64_t published;
+        bool stop;
+        // when each disabled pattern was disabled, and the generations it has to be muted in.
+        std::unordered_map<uint32_t, std::chrono::steady_clock::time_point> disabled;
+        std::chrono::seconds compact_after;
+        std::vector<std::weak_ptr<HsDatabase>> live;
+        std::thread worker;
+        std::condition_variable work_cv;
+        std::condition_variable done_cv;
+
+        /**
+         * the generation to scan with, it waits for the first compile if there is none yet.
+         */
+        HsDatabasePtr Acquire();
+
+        /**
+         * the generation a scan of the calling thread uses, it is held by a small thread-local cache and
+         * only refreshed after a publish. Scans don't touch the shared refcount of the generation then.
+         * A thread that stops scanning keeps the generation it used last until it scans again or exits,
+         * or until any matcher is destroyed.
+         */
+        HsDatabase *Cached();
+
+        /**
+         * the generation of one scan from @ref Cached(), it lives on the stack of the scan. Generations
+         * replaced while scans of the thread are in flight, e.g. by a scan from a callback, are kept
+         * until the outermost lease ends.
+         */
+        class Lease
+        {
+        public:
+            explicit Lease(HsMatcher &matcher) : gen(matcher.Cached()) {}
+            ~Lease() { Release(); }
+            Lease(const Lease &) = delete;
+            Lease &operator=(const Lease &) = delete;
+
+            explicit operator bool() const { return gen != nullptr; }
+            HsDatabase &operator*() const { return *gen; }
+            HsDatabase *operator->() const { return gen; }
+
+        private:
+            static void Release();
+            HsDatabase *gen;
+        };
+
+        void Schedule();
+        void Publish(HsDatabasePtr gen, uint64_t version);
+        void CompileLoop();
+        bool EraseIds(const std::vector<uint32_t> &ids);
+        bool MuteLive(uint32_t id, bool mute);
+        void Compact();
+        static int Build(const std::vector<PatPtr> &snapshot, const std::vector<PatternStorePtr> &stores, const CompileOptions &opts, HsDatabasePtr &gen);
+        static std::vector<std::vector<size_t>> Partition(const std::vector<PatternRef> &refs, const std::vector<size_t> &members, const CompileOptions &opts);
+
+        /**
+         * compile the patterns into one database, or two if some are compiled as literals, without cache.
+         */
+        static int CompileGroup(const std::vector<PatternRef> &group, const CompileOptions &opts, std::vector<hs_database_t *> &dbs);
+
+        static inline const char *BlockData(const DataBlock &block) { return block.data; }
+        static inline size_t BlockLen(const DataBlock &block) { return block.len; }
+        static inline const char *BlockData(const struct iovec &block) { return static_cast<const char *>(block.iov_base); }
+        static inline size_t BlockLen(const struct iovec &block) { return block.iov_len; }
+
+        /**
+         * scan one block with every shard of the generation, it stops when a callback asks to.
+         */
+        template <typename F>
+        static int ScanData(HsDatabase &gen, DataBlock data, F &handler, UserCtx *ctx, bool safe)
+        {
+            StatsTimer timer(gen.stats.get(), safe ? StatsKind::safe_match : StatsKind::match, data.len);
+            uint32_t slot = 0;
+            auto scr = safe ? gen.scratch->GetSafeScratch(slot) : gen.scratch->GetScratch();
+            int ret = ScanWith(gen, data, handler, ctx, scr);
+            if (safe)
+            {
+                gen.scratch->Release(slot);
+            }
+            return ret;
+        }
+
+        /**
+         * @ref ScanData() that counts hits against the options and stops when one of the limits is reached.
+         */
+        template <typename F>
+        static ScanResult ScanLimited(HsDatabase &gen, DataBlock data, const ScanOptions &opts, F &handler, UserCtx *ctx, bool safe)
+        {
+            ScanBudget budget(opts);
+            data.len = budget.Take(data.len);
+            auto limited = [&budget, &handler](unsigned int id, unsigned long long from, unsigned long long to, const UserCtx *mctx, const UserCtx *pctx) -> int
+            {
+                return budget.Hit(id, handler(id, from, to, mctx, pctx));
+            };
+            return budget.Result(ScanData(gen, data, limited, ctx, safe));
+        }
+
+        /**
+         * same as @ref ScanData(), with a scratch the caller owns.
+         */
+        template <typename F>
+        static int ScanWith(HsDatabase &gen, DataBlock data, F &handler, UserCtx *ctx, hs_scratch_t *scr)
+        {
+            if (!Fits(data.len))
+            {
+                return HS_INVALID;
+            }
+            HandlerCtx<typename std::remove_reference<F>::type> scanctx{&handler, ctx, &gen.index, gen.HitRow(), data.data, data.len};
+            int ret = HS_SUCCESS;
+            for (auto &&db : gen.dbs)
+            {
+                ret = hs_scan(db, data.data, static_cast<unsigned int>(data.len), 0, scr, OnHit<typename std::remove_reference<F>::type>, &scanctx);
+                if (ret != HS_SUCCESS)
+                {
+                    break;
+                }
+            }
+            return ret;
+        }
+
+        /**
+         * false, and the error logged, if a block is too long for the 32-bit length hyperscan takes.
+         */
+        static bool Fits(size_t len);
+
+        /**
+         * scan the data as one stream with every shard of a streaming generation, in pieces of up to 4GB.
+         * Offsets are counted from the start of the data, and end-of-data matches are reported.
+         */
+        template <typename F>
+        static int ScanPieces(HsDatabase &gen, DataBlock data, F &handler, UserCtx *ctx)
+        {
+            StatsTimer timer(gen.stats.get(), StatsKind::stream, data.len);
+            HandlerCtx<typename std::remove_reference<F>::type> scanctx{&handler, ctx, &gen.index, gen.HitRow(), data.data, data.len};
+            auto onhit = OnHit<typename std::remove_reference<F>::type>;
+            uint32_t slot = 0;
+            auto scr = gen.scratch->GetSafeScratch(slot);
+            int ret = HS_SUCCESS;
+            for (auto &&db : gen.dbs)
+            {
+                hs_stream_t *stream = nullptr;
+                ret = hs_open_stream(db, 0, &stream);
+                if (ret != HS_SUCCESS)
+                {
+                    HSCPP_DLOG(Error, "hs open stream error! error no is%d", ret);
+                    break;
+                }
+                for (size_t pos = 0; pos < data.len && ret == HS_SUCCESS; pos += STREAM_PIECE)
+                {
+                    size_t len = std::min(data.len - pos, STREAM_PIECE);
+                    ret = hs_scan_stream(stream, data.data + pos, static_cast<unsigned int>(len), 0, scr, onhit, &scanctx);
+                }
+                // end-of-data matches are only reported if all the data was scanned.
+                if (ret == HS_SUCCESS)
+                {
+                    ret = hs_close_stream(stream, scr, onhit, &scanctx);
+                }
+                else
+                {
+                    hs_close_stream(stream, nullptr, nullptr, nullptr);
+                }
+                if (ret != HS_SUCCESS)
+                {
+                    break;
+                }
+            }
+            gen.scratch->Release(slot);
+            return ret;
+        }
+
+        template <typename Block, typename F>
+        void ScanBlocks(const Block *blocks, size_t count, F &handler, UserCtx *ctx, bool safe)
+        {
+            Lease gen(*this);
+            if (!gen)
+            {
+                return;
+            }
+
+            const char *stack_data[VECTOR_STACK_BLOCKS];
+            unsigned int stack_len[VECTOR_STACK_BLOCKS];
+            std::vector<const char *> heap_data;
+            std::vector<unsigned int> heap_len;
+            const char **vdata = stack_data;
+            unsigned int *vlen = stack_len;
+            if (count > VECTOR_STACK_BLOCKS)
+            {
+                heap_data.resize(count);
+                heap_len.resize(count);
+                vdata = heap_data.data();
+                vlen = heap_len.data();
+            }
+            StatsTimer timer(gen->stats.get(), safe ? StatsKind::safe_match : StatsKind::match);
+            for (size_t i = 0; i < count; i++)
+            {
+                if (!Fits(BlockLen(blocks[i])))
+                {
+                    return;
+                }
+                vdata[i] = BlockData(blocks[i]);
+                vlen[i] = static_cast<unsigned int>(BlockLen(blocks[i]));
+                timer.bytes += vlen[i];
+            }
+
+            HandlerCtx<F> scanctx{&handler, ctx, &gen->index, gen->HitRow(), nullptr, 0};
+            uint32_t slot = 0;
+            auto scr = safe ? gen->scratch->GetSafeScratch(slot) : gen->scratch->GetScratch();
+            int ret = HS_SUCCESS;
+            for (auto &&db : gen->dbs)
+            {
+                ret = hs_scan_vector(db, vdata, vlen, static_cast<unsigned int>(count), 0, scr, OnHit<F>, &scanctx);
+                if (ret != HS_SUCCESS)
+                {
+                    break;
+                }
+            }
+            if (safe)
+            {
+                gen->scratch->Release(slot);
+            }
+            if (ret == HS_DB_MODE_ERROR)
+            {
+                HSCPP_DLOG(Error, "the matcher is not in vector mode, vectored match failed!");
+            }
+        }
+
+        /**
+         * scan the records one by one with every shard of the generation and one scratch.
+         */
+        template <typename F>
+        static int ScanBatch(HsDatabase &gen, const DataBlock *records, size_t count, F &handler, UserCtx *const *ctxs, bool safe, size_t *stop = nullptr)
+        {
+            BatchCtx<F> scanctx{&handler, nullptr, &gen.index, gen.HitRow(), 0, nullptr, 0};
+            StatsTimer timer(gen.stats.get(), safe ? StatsKind::safe_match : StatsKind::match);
+            if (timer.Active())
+            {
+                for (size_t i = 0; i < count; i++)
+                {
+                    timer.bytes += records[i].len;
+                }
+            }
+            uint32_t slot = 0;
+            auto scr = safe ? gen.scratch->GetSafeScratch(slot) : gen.scratch->GetScratch();
+            int ret = HS_SUCCESS;
+            size_t i = 0;
+            for (; i < count; i++)
+            {
+                scanctx.record = i;
+                scanctx.ctx = ctxs ? ctxs[i] : nullptr;
+                scanctx.data = records[i].data;
+                scanctx.len = records[i].len;
+                if (!Fits(records[i].len))
+                {
+                    ret = HS_INVALID;
+                    break;
+                }
+                for (auto &&db : gen.dbs)
+                {
+                    ret = hs_scan(db, records[i].data, static_cast<unsigned int>(records[i].len), 0, scr, OnBatchHit<F>, &scanctx);
+                    if (ret != HS_SUCCESS)
+                    {
+                        break;
+                    }
+                }
+                if (ret != HS_SUCCESS)
+                {
+                    break;
+                }
+            }
+            if (safe)
+            {
+                gen.scratch->Release(slot);
+            }
+            if (stop)
+            {
+                *stop = i;
+            }
+            return ret;
+        }
+
+        struct ChunkHit
+        {
+            unsigned int id;
+            unsigned long long from;
+            unsigned long long to;
+        };
+
+        /**
+         * scan the data in overlapping chunks on several threads, and pass the hits of every chunk to deliver
+         * on the calling thread, in order. deliver returns true to stop. It returns false if the data should
+         * be scanned in one piece instead.
+         */
+        static bool ScanChunks(HsDatabase &gen, DataBlock data, uint32_t threads, const std::function<bool(const std::vector<ChunkHit> &)> &deliver, int &ret);
+        static unsigned int MaxWidth(HsDatabase &gen);
+
+        int ScanFile(const std::string &path, MatchCb &handler, UserCtx *ctx);
+
+        size_t BatchInto(const DataBlock *records, size_t count, BatchHit *hits, size_t capacity, size_t *next, bool safe);
+        int CollectInto(DataBlock data, ResultBuffer &results, bool safe);
+
+        template <typename F>
+        struct HandlerCtx
+        {
+            F *handler;
+            UserCtx *ctx;
+            const PatternIndex *index;
+            // the hit counters of the thread, nullptr if stats are disabled.
+            std::atomic<uint64_t> *hits;
+            // the data of a block scan, to confirm prefilter hits. Streams and vectors leave it nullptr.
+            const char *data;
+            size_t len;
+        };
+
+        template <typename F>
+        static int OnHit(unsigned int id, unsigned long long from, unsigned long long to, unsigned int, void *context)
+        {
+            HandlerCtx<F> *scanctx = static_cast<HandlerCtx<F> *>(context);
+            const PatternEntry *target = scanctx->index->Find(id);
+            if (!target)
+            {
+                HSCPP_DLOG(Warning, "no pattern matched but matcher hit, check mutithread!!!");
+                return 0;
+            }
+            uint32_t slot = scanctx->index->Slot(target);
+            if (scanctx->index->Muted(slot) || !Confirmed(target, scanctx->data, scanctx->len, from, to))
+            {
+                return 0;
+            }
+            if (scanctx->hits)
+            {
+                scanctx->hits[slot].fetch_add(1, std::memory_order_relaxed);
+            }
+            return (*scanctx->handler)(id, from, to, scanctx->ctx, target->ctx);
+        }
+
+        /**
+         * false if the pattern was compiled with the prefilter flag and the candidate hit is not a real
+         * match. Only streams and vectors have no data to check hits against, and they have no prefilter
+         * patterns.
+         */
+        static inline bool Confirmed(const PatternEntry *target, const char *data, size_t len, unsigned long long from, unsigned long long to)
+        {
+            return !target->confirm || !data || !target->confirm->Prefilter() || target->confirm->Confirm(data, len, from, to);
+        }
+
+        /**
+         * build the regexes of the prefilter and capture patterns of a generation. A pattern std::regex can't
+         * take is left without one: its hits are passed unconfirmed and it has no captures, but a prefilter
+         * pattern fails the build if unconfirmed hits are to be dropped. Prefilter patterns fail the build in
+         * stream and vector mode.
+         */
+        static int BuildConfirms(const std::vector<PatternRef> &refs, const CompileOptions &opts, HsDatabase &gen);
+
+        static int OnCollect(unsigned int id, unsigned long long from, unsigned long long to, unsigned int, void *context);
+
+        template <typename F>
+        struct BatchCtx
+        {
+            F *handler;
+            UserCtx *ctx;
+            const PatternIndex *index;
+            std::atomic<uint64_t> *hits;
+            size_t record;
+            // the record being scanned.
+            const char *data;
+            size_t len;
+        };
+
+        template <typename F>
+        static int OnBatchHit(unsigned int id, unsigned long long from, unsigned long long to, unsigned int, void *context)
+        {
+            BatchCtx<F> *scanctx = static_cast<BatchCtx<F> *>(context);
+            const PatternEntry *target = scanctx->index->Find(id);
+            if (!target)
+            {
+                HSCPP_DLOG(Warning, "no pattern matched but matcher hit, check mutithread!!!");
+                return 0;
+            }
+            uint32_t slot = scanctx->index->Slot(target);
+            if (scanctx->index->Muted(slot) || !Confirmed(target, scanctx->data, scanctx->len, from, to))
+            {
+                return 0;
+            }
+            if (scanctx->hits)
+            {
+                scanctx->hits[slot].fetch_add(1, std::memory_order_relaxed);
+            }
+            return (*scanctx->handler)(scanctx->record, id, from, to, scanctx->ctx, target->ctx);
+        }
     };
 
 }
\ No newline at end of file
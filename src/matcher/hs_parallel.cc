@@ -0,0 +1,175 @@
+#include "hs_matcher.h"
+#include <algorithm>
+#include <limits>
+#include <stdlib.h>
+#include "debug_log.h"
+
+namespace Echidna
+{
+    namespace
+    {
+        constexpr unsigned int UNBOUNDED = std::numeric_limits<unsigned int>::max();
+
+        // chunks smaller than this are not worth a thread.
+        constexpr size_t MIN_CHUNK = 256 * 1024;
+
+        // bytes scanned after a chunk, so that $ and \b at its end see the data that follows.
+        constexpr size_t LOOKAHEAD = 2;
+
+        // chunks per thread, so that the first hits are delivered early and a stop skips most of the data.
+        constexpr size_t CHUNKS_PER_THREAD = 8;
+    }
+
+    unsigned int HsMatcher::MaxWidth(HsDatabase &gen)
+    {
+        std::call_once(gen.width_once, [&gen]
+                       {
+            unsigned int width = 0;
+            std::vector<PatternRef> refs;
+            CollectRefs(gen.patterns, gen.stores, refs);
+            for (auto &&pat : refs)
+            {
+                // these are evaluated against the whole data, a chunk can't tell them.
+                if (pat.flag & (HS_FLAG_COMBINATION | HS_FLAG_SINGLEMATCH))
+                {
+                    width = UNBOUNDED;
+                    break;
+                }
+                auto ext = pat.ext;
+                if (ext && (ext->flags & (HS_EXT_FLAG_MIN_OFFSET | HS_EXT_FLAG_MAX_OFFSET)))
+                {
+                    width = UNBOUNDED;
+                    break;
+                }
+                if (pat.literal)
+                {
+                    width = std::max<unsigned int>(width, pat.len);
+                    continue;
+                }
+
+                hs_expr_info_t *info = nullptr;
+                hs_compile_error_t *err = nullptr;
+                auto res = hs_expression_ext_info(pat.expr, pat.flag, ext, &info, &err);
+                if (res != HS_SUCCESS)
+                {
+                    HSCPP_DLOG(Warning, "hs expression info error! %s expression: %s", err ? err->message : "", pat.expr);
+                    hs_free_compile_error(err);
+                    width = UNBOUNDED;
+                    break;
+                }
+                if (info->max_width > width)
+                {
+                    width = info->max_width;
+                }
+                free(info);
+                if (width == UNBOUNDED)
+                {
+                    break;
+                }
+            }
+            gen.max_width = width; });
+        return gen.max_width;
+    }
+
+    bool HsMatcher::ScanChunks(HsDatabase &gen, DataBlock data, uint32_t threads, const std::function<bool(const std::vector<ChunkHit> &)> &deliver, int &ret)
+    {
+        if (!threads)
+        {
+            threads = std::thread::hardware_concurrency();
+        }
+        if (threads < 2 || data.len < 2 * MIN_CHUNK || !(gen.mode & HS_MODE_BLOCK))
+        {
+            return false;
+        }
+
+        size_t width = MaxWidth(gen);
+        if (width == UNBOUNDED)
+        {
+            return false;
+        }
+
+        // every window must fit the 32-bit length hyperscan takes.
+        size_t max_chunk = std::numeric_limits<unsigned int>::max() - width - LOOKAHEAD;
+        size_t pieces = static_cast<size_t>(threads) * CHUNKS_PER_THREAD;
+        size_t chunk = std::max(MIN_CHUNK, std::max(width * 16, (data.len + pieces - 1) / pieces));
+        chunk = std::min(chunk, max_chunk);
+        size_t count = (data.len + chunk - 1) / chunk;
+        if (count < 2)
+        {
+            return false;
+        }
+
+        std::vector<std::vector<ChunkHit>> hits(count);
+        std::vector<int> results(count, HS_SUCCESS);
+        // chunks scanned so far, guarded by mtx. The calling thread delivers them in order meanwhile.
+        std::vector<bool> done(count, false);
+        std::mutex mtx;
+        std::condition_variable done_cv;
+        // set when the handler asks to stop or a chunk fails, chunks not started yet are skipped then.
+        std::atomic<bool> stop(false);
+        std::atomic<size_t> next(0);
+        auto work = [&]()
+        {
+            size_t i;
+            while ((i = next++) < count && !stop.load(std::memory_order_relaxed))
+            {
+                // only hits that end in (start, end] belong to the chunk, the rest are found by its neighbours.
+                size_t start = i * chunk;
+                size_t end = std::min(data.len, start + chunk);
+                size_t base = start > width ? start - width : 0;
+                size_t limit = std::min(data.len, end + LOOKAHEAD);
+                auto &out = hits[i];
+                auto collect = [&](unsigned int id, unsigned long long from, unsigned long long to, const UserCtx *, const UserCtx *) -> int
+                {
+                    to += base;
+                    if ((to > start || !start) && to <= end)
+                    {
+                        out.push_back(ChunkHit{id, from ? from + base : 0, to});
+                    }
+                    return stop.load(std::memory_order_relaxed) ? 1 : 0;
+                };
+                results[i] = ScanData(gen, DataBlock(data.data + base, limit - base), collect, nullptr, true);
+                std::lock_guard<std::mutex> lock(mtx);
+                done[i] = true;
+                done_cv.notify_all();
+            }
+        };
+
+        std::vector<std::thread> pool;
+        for (uint32_t i = 0; i < threads && i < count; i++)
+        {
+            pool.emplace_back(work);
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                done_cv.wait(lock, [&]
+                             { return done[i]; });
+            }
+            if (results[i] != HS_SUCCESS)
+            {
+                ret = results[i];
+                stop = true;
+                break;
+            }
+            if (deliver(hits[i]))
+            {
+                ret = HS_SCAN_TERMINATED;
+                stop = true;
+                break;
+            }
+            std::vector<ChunkHit>().swap(hits[i]);
+        }
+        for (auto &&th : pool)
+        {
+            th.join();
+        }
+        return true;
+    }
+
+    int HsMatcher::ParallelMatch(DataBlock data, uint32_t threads, UserCtx *ctx)
+    {
+        return ParallelMatch(data, threads, cb_handler, ctx);
+    }
+}
@@ -0,0 +1,262 @@
+#include "hs_matcher.h"
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <stdio.h>
+#include <stdlib.h>
+#include "debug_log.h"
+
+namespace Echidna
+{
+    namespace
+    {
+        using Clock = std::chrono::steady_clock;
+
+        constexpr unsigned int UNBOUNDED = std::numeric_limits<unsigned int>::max();
+
+        uint64_t Since(Clock::time_point start)
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+        }
+
+        int CountHit(unsigned int, unsigned long long, unsigned long long, unsigned int, void *context)
+        {
+            ++*static_cast<uint64_t *>(context);
+            return 0;
+        }
+
+        void Widths(const PatternRef &pat, PatternCost &cost)
+        {
+            unsigned int min_width = 0;
+            unsigned int max_width = UNBOUNDED;
+            if (pat.literal)
+            {
+                min_width = max_width = static_cast<unsigned int>(pat.len);
+            }
+            else
+            {
+                hs_expr_info_t *info = nullptr;
+                hs_compile_error_t *err = nullptr;
+                if (hs_expression_ext_info(pat.expr, pat.flag, pat.ext, &info, &err) == HS_SUCCESS)
+                {
+                    min_width = info->min_width;
+                    max_width = info->max_width;
+                    free(info);
+                }
+                else
+                {
+                    hs_free_compile_error(err);
+                }
+            }
+            cost.min_width = cost.ids.size() == 1 ? min_width : std::min(cost.min_width, min_width);
+            cost.max_width = std::max(cost.max_width, max_width);
+        }
+
+        void Sizes(const std::vector<hs_database_t *> &dbs, uint32_t mode, PatternCost &cost)
+        {
+            for (auto &&db : dbs)
+            {
+                size_t size = 0;
+                if (hs_database_size(db, &size) == HS_SUCCESS)
+                {
+                    cost.db_size += size;
+                }
+                if ((mode & HS_MODE_STREAM) && hs_stream_size(db, &size) == HS_SUCCESS)
+                {
+                    cost.stream_size += size;
+                }
+            }
+        }
+
+        /**
+         * the fastest of some scans of the corpus with the databases one after another, as a matcher does.
+         */
+        void ScanCost(const std::vector<hs_database_t *> &dbs, uint32_t mode, const ProfileOptions &opts, PatternCost &cost)
+        {
+            if (!opts.corpus)
+            {
+                return;
+            }
+            hs_scratch_t *scr = nullptr;
+            for (auto &&db : dbs)
+            {
+                if (hs_alloc_scratch(db, &scr) != HS_SUCCESS)
+                {
+                    HSCPP_DLOG(Warning, "hs alloc scratch error, pattern %u is not scanned!", cost.ids.empty() ? 0 : cost.ids[0]);
+                    hs_free_scratch(scr);
+                    return;
+                }
+            }
+
+            const char *data = opts.corpus;
+            unsigned int len = static_cast<unsigned int>(std::min<size_t>(opts.corpus_len, UNBOUNDED));
+            for (uint32_t r = 0; r < std::max(1u, opts.repeat); r++)
+            {
+                uint64_t hits = 0;
+                auto start = Clock::now();
+                for (auto &&db : dbs)
+                {
+                    if (mode & HS_MODE_STREAM)
+                    {
+                        hs_stream_t *stream = nullptr;
+                        if (hs_open_stream(db, 0, &stream) == HS_SUCCESS)
+                        {
+                            hs_scan_stream(stream, data, len, 0, scr, CountHit, &hits);
+                            hs_close_stream(stream, scr, CountHit, &hits);
+                        }
+                    }
+                    else if (mode & HS_MODE_VECTORED)
+                    {
+                        hs_scan_vector(db, &data, &len, 1, 0, scr, CountHit, &hits);
+                    }
+                    else
+                    {
+                        hs_scan(db, data, len, 0, scr, CountHit, &hits);
+                    }
+                }
+                uint64_t ns = Since(start);
+                if (!r || ns < cost.scan_ns)
+                {
+                    cost.scan_ns = ns;
+                }
+                cost.hits = hits;
+            }
+            hs_free_scratch(scr);
+        }
+
+        bool Costlier(const PatternCost &a, const PatternCost &b)
+        {
+            if ((a.ret != HS_SUCCESS) != (b.ret != HS_SUCCESS))
+            {
+                return a.ret != HS_SUCCESS;
+            }
+            if (a.scan_ns != b.scan_ns)
+            {
+                return a.scan_ns > b.scan_ns;
+            }
+            if (a.compile_ns != b.compile_ns)
+            {
+                return a.compile_ns > b.compile_ns;
+            }
+            return a.db_size > b.db_size;
+        }
+    }
+
+    int HsMatcher::Profile(const ProfileOptions &popts, ProfileResult &result)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        std::vector<PatPtr> snapshot = patterns;
+        std::vector<PatternStorePtr> store_snapshot = stores;
+        CompileOptions opts = options;
+        lock.unlock();
+        // every compile is measured, none comes from the cache.
+        opts.cache.reset();
+
+        result = ProfileResult();
+        std::vector<PatternRef> refs;
+        CollectRefs(snapshot, store_snapshot, refs);
+        if (refs.empty())
+        {
+            HSCPP_DLOG(Notice, "The matcher is empty!");
+            return HS_INVALID;
+        }
+
+        HsDatabasePtr gen;
+        auto start = Clock::now();
+        result.total.ret = Build(snapshot, store_snapshot, opts, gen);
+        result.total.compile_ns = Since(start);
+        if (result.total.ret == HS_SUCCESS)
+        {
+            Sizes(gen->dbs, opts.mode, result.total);
+            ScanCost(gen->dbs, opts.mode, popts, result.total);
+        }
+
+        size_t group = std::max<size_t>(1, popts.group);
+        std::vector<PatternRef> members;
+        std::vector<hs_database_t *> dbs;
+        for (size_t begin = 0; begin < refs.size(); begin += group)
+        {
+            PatternCost cost;
+            members.clear();
+            for (size_t i = begin; i < std::min(refs.size(), begin + group); i++)
+            {
+                if (refs[i].flag & HS_FLAG_COMBINATION)
+                {
+                    HSCPP_DLOG(Notice, "logical combination %u can't be profiled alone, skipped.", refs[i].id);
+                    continue;
+                }
+                members.push_back(refs[i]);
+                cost.ids.push_back(refs[i].id);
+                Widths(refs[i], cost);
+            }
+            if (members.empty())
+            {
+                continue;
+            }
+            cost.expr.assign(members[0].expr, members[0].len);
+
+            start = Clock::now();
+            cost.ret = CompileGroup(members, opts, dbs);
+            cost.compile_ns = Since(start);
+            if (cost.ret == HS_SUCCESS)
+            {
+                Sizes(dbs, opts.mode, cost);
+                ScanCost(dbs, opts.mode, popts, cost);
+                for (auto &&db : dbs)
+                {
+                    hs_free_database(db);
+                }
+            }
+            result.patterns.push_back(std::move(cost));
+        }
+
+        std::stable_sort(result.patterns.begin(), result.patterns.end(), Costlier);
+        return HS_SUCCESS;
+    }
+
+    std::string ProfileReport(const ProfileResult &result, size_t top)
+    {
+        std::string out;
+        char line[512];
+        const PatternCost &total = result.total;
+        snprintf(line, sizeof(line), "total: ret %d, compile %.3f ms, database %zu bytes, stream state %zu bytes, scan %.3f ms, hits %llu\n",
+                 total.ret, total.compile_ns / 1e6, total.db_size, total.stream_size, total.scan_ns / 1e6,
+                 static_cast<unsigned long long>(total.hits));
+        out.append(line);
+        snprintf(line, sizeof(line), "%5s %-12s %4s %10s %8s %10s %10s %8s %6s %6s  %s\n",
+                 "rank", "id", "ret", "scan_ms", "of_total", "hits", "compile_ms", "db_bytes", "state", "width", "expression");
+        out.append(line);
+
+        size_t count = top ? std::min(top, result.patterns.size()) : result.patterns.size();
+        for (size_t i = 0; i < count; i++)
+        {
+            const PatternCost &cost = result.patterns[i];
+            std::string id = std::to_string(cost.ids.empty() ? 0 : cost.ids[0]);
+            if (cost.ids.size() > 1)
+            {
+                id += "+" + std::to_string(cost.ids.size() - 1);
+            }
+            std::string width = cost.max_width == UNBOUNDED ? "inf" : std::to_string(cost.max_width);
+            // the expression on one line, cut to keep the table readable.
+            std::string expr = cost.expr.substr(0, 60);
+            for (auto &&c : expr)
+            {
+                if (static_cast<unsigned char>(c) < 0x20 || c == 0x7f)
+                {
+                    c = '.';
+                }
+            }
+            if (cost.expr.size() > expr.size())
+            {
+                expr += "...";
+            }
+            // the scan time of the pattern alone, as a share of the scan time of the whole set.
+            double share = total.scan_ns ? static_cast<double>(cost.scan_ns) / total.scan_ns : 0;
+            snprintf(line, sizeof(line), "%5zu %-12s %4d %10.3f %8.3f %10llu %10.3f %8zu %6zu %6s  %s\n",
+                     i + 1, id.c_str(), cost.ret, cost.scan_ns / 1e6, share, static_cast<unsigned long long>(cost.hits),
+                     cost.compile_ns / 1e6, cost.db_size, cost.stream_size, width.c_str(), expr.c_str());
+            out.append(line);
+        }
+        return out;
+    }
+}
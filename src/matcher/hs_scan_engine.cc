@@ -0,0 +1,289 @@
+#include "hs_scan_engine.h"
+#include "debug_log.h"
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace Echidna
+{
+    HsScanEngine::HsScanEngine(HsMatcher &umatcher, uint32_t threads, size_t ucapacity, const std::vector<int> &cpus)
+        : matcher(umatcher),
+          cb_handler(umatcher.cb_handler),
+          capacity(ucapacity ? ucapacity : 1),
+          next(0),
+          reserved(0),
+          ready(0),
+          outstanding(0),
+          sleeping(0),
+          blocked(0),
+          stop(false)
+    {
+        Start(threads, cpus);
+    }
+
+    HsScanEngine::HsScanEngine(HsMatcher &umatcher, MatchCb cb, uint32_t threads, size_t ucapacity, const std::vector<int> &cpus)
+        : matcher(umatcher),
+          cb_handler(cb),
+          capacity(ucapacity ? ucapacity : 1),
+          next(0),
+          reserved(0),
+          ready(0),
+          outstanding(0),
+          sleeping(0),
+          blocked(0),
+          stop(false)
+    {
+        Start(threads, cpus);
+    }
+
+    HsScanEngine::~HsScanEngine()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stop = true;
+        }
+        work_cv.notify_all();
+        space_cv.notify_all();
+        for (auto &&worker : workers)
+        {
+            worker->thread.join();
+            hs_free_scratch(worker->scr);
+        }
+    }
+
+    void HsScanEngine::Start(uint32_t threads, const std::vector<int> &cpus)
+    {
+        if (!threads)
+        {
+            threads = std::thread::hardware_concurrency();
+        }
+        if (!threads)
+        {
+            threads = 1;
+        }
+
+        for (uint32_t i = 0; i < threads; i++)
+        {
+            workers.emplace_back(new Worker());
+        }
+        for (uint32_t i = 0; i < threads; i++)
+        {
+            workers[i]->thread = std::thread(&HsScanEngine::Loop, this, i);
+            if (cpus.empty())
+            {
+                continue;
+            }
+#ifdef __linux__
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpus[i % cpus.size()], &set);
+            int res = pthread_setaffinity_np(workers[i]->thread.native_handle(), sizeof(set), &set);
+            if (res)
+            {
+                HSCPP_DLOG(Warning, "set worker affinity error! error no is%d", res);
+            }
+#else
+            HSCPP_DLOG(Warning, "worker affinity is not supported on this platform!");
+#endif
+        }
+    }
+
+    bool HsScanEngine::Reserve(bool wait)
+    {
+        size_t cur = reserved.load(std::memory_order_relaxed);
+        while (true)
+        {
+            if (cur < capacity)
+            {
+                if (reserved.compare_exchange_weak(cur, cur + 1))
+                {
+                    outstanding++;
+                    return true;
+                }
+                continue;
+            }
+            if (!wait)
+            {
+                return false;
+            }
+
+            std::unique_lock<std::mutex> lock(mtx);
+            blocked++;
+            space_cv.wait(lock, [this]
+                          { return stop || reserved.load() < capacity; });
+            blocked--;
+            if (stop)
+            {
+                return false;
+            }
+            cur = reserved.load(std::memory_order_relaxed);
+        }
+    }
+
+    void HsScanEngine::Push(Task &&task)
+    {
+        auto &worker = *workers[next.fetch_add(1, std::memory_order_relaxed) % workers.size()];
+        {
+            std::lock_guard<std::mutex> lock(worker.mtx);
+            worker.tasks.push_back(std::move(task));
+        }
+        ready++;
+        // a worker that saw no task has published it is sleeping before checking again.
+        if (sleeping.load())
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            work_cv.notify_one();
+        }
+    }
+
+    bool HsScanEngine::Take(size_t self, Task &task)
+    {
+        // the own queue from the front, the others from the back.
+        bool taken = false;
+        for (size_t i = 0; i < workers.size() && !taken; i++)
+        {
+            auto &worker = *workers[(self + i) % workers.size()];
+            std::lock_guard<std::mutex> lock(worker.mtx);
+            if (worker.tasks.empty())
+            {
+                continue;
+            }
+            if (!i)
+            {
+                task = std::move(worker.tasks.front());
+                worker.tasks.pop_front();
+            }
+            else
+            {
+                task = std::move(worker.tasks.back());
+                worker.tasks.pop_back();
+            }
+            taken = true;
+        }
+        if (!taken)
+        {
+            return false;
+        }
+
+        ready--;
+        reserved--;
+        if (blocked.load())
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            space_cv.notify_one();
+        }
+        return true;
+    }
+
+    void HsScanEngine::Run(Worker &worker, Task &task)
+    {
+        auto gen = matcher.Acquire();
+        int ret = HS_INVALID;
+        if (gen)
+        {
+            if (gen != worker.gen)
+            {
+                hs_free_scratch(worker.scr);
+                worker.scr = gen->scratch->Clone();
+                worker.gen = gen;
+            }
+            StatsTimer timer(gen->stats.get(), StatsKind::safe_match, task.data.len);
+            ret = HsMatcher::ScanWith(*gen, task.data, cb_handler, task.ctx, worker.scr);
+        }
+
+        if (task.done)
+        {
+            task.done(ret);
+        }
+        else if (task.result)
+        {
+            task.result->set_value(ret);
+        }
+        if (--outstanding == 0)
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            done_cv.notify_all();
+        }
+    }
+
+    void HsScanEngine::Loop(size_t self)
+    {
+        auto &worker = *workers[self];
+        while (true)
+        {
+            {
+                // a task without a promise holds no allocation, and it is gone before the worker sleeps.
+                Task task;
+                if (Take(self, task))
+                {
+                    Run(worker, task);
+                    continue;
+                }
+            }
+
+            std::unique_lock<std::mutex> lock(mtx);
+            sleeping++;
+            work_cv.wait(lock, [this]
+                         { return stop || ready.load() > 0; });
+            sleeping--;
+            if (stop && !ready.load())
+            {
+                break;
+            }
+        }
+        worker.gen.reset();
+    }
+
+    std::future<int> HsScanEngine::Submit(DataBlock data, UserCtx *ctx)
+    {
+        Task task{data, ctx, nullptr, std::unique_ptr<std::promise<int>>(new std::promise<int>())};
+        auto result = task.result->get_future();
+        if (!Reserve(true))
+        {
+            task.result->set_value(HS_INVALID);
+            return result;
+        }
+        Push(std::move(task));
+        return result;
+    }
+
+    void HsScanEngine::Submit(DataBlock data, ScanDone done, UserCtx *ctx)
+    {
+        if (!Reserve(true))
+        {
+            done(HS_INVALID);
+            return;
+        }
+        Push(Task{data, ctx, std::move(done), nullptr});
+    }
+
+    bool HsScanEngine::TrySubmit(DataBlock data, std::future<int> &result, UserCtx *ctx)
+    {
+        if (!Reserve(false))
+        {
+            return false;
+        }
+        Task task{data, ctx, nullptr, std::unique_ptr<std::promise<int>>(new std::promise<int>())};
+        result = task.result->get_future();
+        Push(std::move(task));
+        return true;
+    }
+
+    bool HsScanEngine::TrySubmit(DataBlock data, ScanDone done, UserCtx *ctx)
+    {
+        if (!Reserve(false))
+        {
+            return false;
+        }
+        Push(Task{data, ctx, std::move(done), nullptr});
+        return true;
+    }
+
+    void HsScanEngine::Wait()
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        done_cv.wait(lock, [this]
+                     { return outstanding.load() == 0; });
+    }
+}
@@ -0,0 +1,137 @@
+#pragma once
+#include "hs_matcher.h"
+#include <deque>
+#include <future>
+
+namespace Echidna
+{
+    /**
+     * it is called with the result of a scan submitted to @ref HsScanEngine, on the worker thread that ran it.
+     */
+    using ScanDone = std::function<void(int ret)>;
+
+    /**
+     * it scans buffers on a pool of worker threads sharing one @ref HsMatcher.
+     *
+     * Every worker has its own queue and its own scratch cloned from the matcher's scratch pool, so
+     * scanning never waits on another thread. Buffers are given to the workers in turn, and an idle worker
+     * steals from the others. The queues are bounded: when they are full, @ref Submit() waits and
+     * @ref TrySubmit() fails, so producers can't run ahead of the workers.
+     *
+     * The matcher must be in block mode and must outlive the engine. Buffers are scanned in place, they
+     * must stay valid until their scan is done.
+     */
+    class HsScanEngine
+    {
+    public:
+        HsScanEngine() = delete;
+        HsScanEngine(const HsScanEngine &) = delete;
+        HsScanEngine &operator=(const HsScanEngine &) = delete;
+
+        /**
+         * @param matcher
+         *      the matcher to scan with, its registed callback is called when hit.
+         * @param threads
+         *      number of workers, 0 means one per hardware thread.
+         * @param capacity
+         *      number of buffers that can wait for a worker.
+         * @param cpus
+         *      pin worker i to cpus[i % cpus.size()], empty means no pinning. Only Linux supports it.
+         */
+        HsScanEngine(HsMatcher &matcher, uint32_t threads = 0, size_t capacity = 4096, const std::vector<int> &cpus = std::vector<int>());
+
+        /**
+         * @param cb
+         *      it will be called instead of the one registed to the matcher when hit, on the worker thread.
+         */
+        HsScanEngine(HsMatcher &matcher, MatchCb cb, uint32_t threads = 0, size_t capacity = 4096, const std::vector<int> &cpus = std::vector<int>());
+
+        /**
+         * Buffers submitted before are scanned, then the workers exit.
+         */
+        ~HsScanEngine();
+
+        /**
+         * Scan a buffer on a worker, it waits while the queues are full.
+         *
+         * @param data
+         *      the data to scan, see @ref DataBlock.
+         * @param ctx
+         *      it will be passed to the callback function if hit.
+         * @return a future of HS_SUCCESS, HS_SCAN_TERMINATED if the callback asked to stop, or a hyperscan
+         *      error code.
+         */
+        std::future<int> Submit(DataBlock data, UserCtx *ctx = nullptr);
+
+        /**
+         * Same as @ref Submit(DataBlock, UserCtx *), but call done when the scan is done instead of a future.
+         */
+        void Submit(DataBlock data, ScanDone done, UserCtx *ctx = nullptr);
+
+        /**
+         * Same as @ref Submit(), but return false at once if the queues are full.
+         */
+        bool TrySubmit(DataBlock data, std::future<int> &result, UserCtx *ctx = nullptr);
+        bool TrySubmit(DataBlock data, ScanDone done, UserCtx *ctx = nullptr);
+
+        /**
+         * Wait until every buffer submitted before is scanned.
+         */
+        void Wait();
+
+        uint32_t Threads() const { return static_cast<uint32_t>(workers.size()); }
+
+        /**
+         * number of buffers waiting for a worker.
+         */
+        size_t Pending() const { return reserved.load(std::memory_order_relaxed); }
+
+    private:
+        struct Task
+        {
+            DataBlock data;
+            UserCtx *ctx;
+            ScanDone done;
+            // only for the submits that return a future, so that a task is cheap to make otherwise.
+            std::unique_ptr<std::promise<int>> result;
+        };
+
+        struct Worker
+        {
+            std::mutex mtx;
+            std::deque<Task> tasks;
+            std::thread thread;
+            // the scratch of the worker, it is cloned again when the matcher moves to a new generation.
+            HsDatabasePtr gen;
+            hs_scratch_t *scr;
+            Worker() : scr(nullptr) {}
+        };
+
+        void Start(uint32_t threads, const std::vector<int> &cpus);
+        bool Reserve(bool wait);
+        void Push(Task &&task);
+        bool Take(size_t self, Task &task);
+        void Run(Worker &worker, Task &task);
+        void Loop(size_t self);
+
+        HsMatcher &matcher;
+        MatchCb cb_handler;
+        size_t capacity;
+        std::vector<std::unique_ptr<Worker>> workers;
+        std::atomic<size_t> next;
+
+        // reserved counts buffers submitted but not taken by a worker, ready the ones in a queue already,
+        // outstanding the ones not done yet.
+        std::atomic<size_t> reserved;
+        std::atomic<size_t> ready;
+        std::atomic<size_t> outstanding;
+        // workers sleeping for a buffer, and producers blocked for space in the queues.
+        std::atomic<size_t> sleeping;
+        std::atomic<size_t> blocked;
+        bool stop;
+        std::mutex mtx;
+        std::condition_variable work_cv;
+        std::condition_variable space_cv;
+        std::condition_variable done_cv;
+    };
+}
@@ -0,0 +1,334 @@
+#include "hs_matcher.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "debug_log.h"
+
+namespace Echidna
+{
+    namespace
+    {
+        constexpr char DB_FILE_MAGIC[8] = {'H', 'S', 'C', 'P', 'P', 'D', 'B', '\0'};
+        constexpr uint32_t DB_FILE_VERSION = 3;
+        constexpr uint32_t DB_FILE_ENDIAN = 0x01020304;
+
+        /**
+         * file layout: header, pattern records, then the serialized hyperscan databases (one per shard), each
+         * one prefixed by its 64-bit length. Every section starts at a multiple of 8 bytes.
+         */
+        struct DbFileHeader
+        {
+            char magic[8];
+            uint32_t version;
+            uint32_t endian;
+            uint32_t compile_mode;
+            uint32_t pattern_count;
+            uint32_t db_count;
+            uint32_t reserved;
+            uint64_t meta_size;
+            uint64_t db_size;
+            char hs_version[64];
+        };
+
+        /**
+         * one pattern record, followed by expr_len bytes of expression and padding to 8 bytes.
+         */
+        struct DbFilePattern
+        {
+            uint32_t id;
+            uint32_t flag;
+            uint32_t expr_len;
+            uint32_t has_ext;
+            uint64_t ext_flags;
+            uint64_t min_offset;
+            uint64_t max_offset;
+            uint64_t min_length;
+            uint32_t edit_distance;
+            uint32_t hamming_distance;
+            uint32_t literal;
+            uint32_t capture;
+        };
+
+        inline size_t Align8(size_t len)
+        {
+            return (len + 7) & ~static_cast<size_t>(7);
+        }
+
+        bool WriteAll(int fd, const void *buf, size_t len)
+        {
+            const char *p = static_cast<const char *>(buf);
+            while (len)
+            {
+                ssize_t n = write(fd, p, len);
+                if (n <= 0)
+                {
+                    return false;
+                }
+                p += n;
+                len -= n;
+            }
+            return true;
+        }
+
+        bool WritePadding(int fd, size_t len)
+        {
+            static const char zeros[8] = {0};
+            return WriteAll(fd, zeros, Align8(len) - len);
+        }
+    }
+
+    int HsMatcher::Save(const std::string &path)
+    {
+        auto gen = Acquire();
+        if (!gen)
+        {
+            return HS_INVALID;
+        }
+        std::vector<PatternRef> patterns;
+        CollectRefs(gen->patterns, gen->stores, patterns);
+
+        std::vector<char *> bytes(gen->dbs.size(), nullptr);
+        std::vector<size_t> lengths(gen->dbs.size(), 0);
+        auto release = [&bytes]()
+        {
+            for (auto &&i : bytes)
+            {
+                free(i);
+            }
+        };
+        for (size_t i = 0; i < gen->dbs.size(); i++)
+        {
+            auto ret = hs_serialize_database(gen->dbs[i], &bytes[i], &lengths[i]);
+            if (ret != HS_SUCCESS)
+            {
+                HSCPP_DLOG(Error, "hs serialize error! error no is%d", ret);
+                release();
+                return ret;
+            }
+        }
+
+        DbFileHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, DB_FILE_MAGIC, sizeof(header.magic));
+        header.version = DB_FILE_VERSION;
+        header.endian = DB_FILE_ENDIAN;
+        header.compile_mode = gen->mode;
+        header.pattern_count = static_cast<uint32_t>(patterns.size());
+        header.db_count = static_cast<uint32_t>(gen->dbs.size());
+        for (auto &&len : lengths)
+        {
+            header.db_size += sizeof(uint64_t) + Align8(len);
+        }
+        strncpy(header.hs_version, hs_version(), sizeof(header.hs_version) - 1);
+        for (auto &&i : patterns)
+        {
+            header.meta_size += sizeof(DbFilePattern) + Align8(i.len);
+        }
+
+        std::string tmp = path + ".tmp";
+        int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            HSCPP_DLOG(Error, "cannot open %s to save database!", tmp.c_str());
+            release();
+            return HS_INVALID;
+        }
+
+        bool ok = WriteAll(fd, &header, sizeof(header));
+        for (auto it = patterns.begin(); ok && it != patterns.end(); ++it)
+        {
+            DbFilePattern rec;
+            memset(&rec, 0, sizeof(rec));
+            rec.id = it->id;
+            rec.flag = it->flag;
+            rec.expr_len = static_cast<uint32_t>(it->len);
+            rec.literal = it->literal ? 1 : 0;
+            rec.capture = it->capture ? 1 : 0;
+            auto ext = it->ext;
+            if (ext)
+            {
+                rec.has_ext = 1;
+                rec.ext_flags = ext->flags;
+                rec.min_offset = ext->min_offset;
+                rec.max_offset = ext->max_offset;
+                rec.min_length = ext->min_length;
+                rec.edit_distance = ext->edit_distance;
+                rec.hamming_distance = ext->hamming_distance;
+            }
+            ok = WriteAll(fd, &rec, sizeof(rec)) && WriteAll(fd, it->expr, it->len) && WritePadding(fd, it->len);
+        }
+        for (size_t i = 0; ok && i < bytes.size(); i++)
+        {
+            uint64_t len = lengths[i];
+            ok = WriteAll(fd, &len, sizeof(len)) && WriteAll(fd, bytes[i], lengths[i]) && WritePadding(fd, lengths[i]);
+        }
+        ok = ok && fsync(fd) == 0;
+        ok = (close(fd) == 0) && ok;
+        release();
+
+        if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+        {
+            HSCPP_DLOG(Error, "write database file %s failed!", path.c_str());
+            unlink(tmp.c_str());
+            return HS_INVALID;
+        }
+        return HS_SUCCESS;
+    }
+
+    int HsMatcher::Load(const std::string &path)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            HSCPP_DLOG(Error, "cannot open database file %s", path.c_str());
+            return HS_INVALID;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(DbFileHeader))
+        {
+            HSCPP_DLOG(Error, "invalid database file %s", path.c_str());
+            close(fd);
+            return HS_INVALID;
+        }
+
+        size_t file_size = st.st_size;
+        void *map = mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED)
+        {
+            HSCPP_DLOG(Error, "cannot map database file %s", path.c_str());
+            return HS_INVALID;
+        }
+        madvise(map, file_size, MADV_SEQUENTIAL);
+        const char *base = static_cast<const char *>(map);
+
+        DbFileHeader header;
+        memcpy(&header, base, sizeof(header));
+        header.hs_version[sizeof(header.hs_version) - 1] = '\0';
+        if (memcmp(header.magic, DB_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != DB_FILE_VERSION || header.endian != DB_FILE_ENDIAN ||
+            header.meta_size > file_size - sizeof(header) ||
+            header.db_size > file_size - sizeof(header) - header.meta_size ||
+            header.pattern_count > header.meta_size / sizeof(DbFilePattern))
+        {
+            HSCPP_DLOG(Error, "unknown database file format: %s", path.c_str());
+            munmap(map, file_size);
+            return HS_INVALID;
+        }
+        if (strcmp(header.hs_version, hs_version()) != 0)
+        {
+            HSCPP_DLOG(Error, "database file is saved by hyperscan %.*s, not %s", static_cast<int>(sizeof(header.hs_version)), header.hs_version, hs_version());
+            munmap(map, file_size);
+            return HS_DB_VERSION_ERROR;
+        }
+        if (hs_valid_platform() != HS_SUCCESS)
+        {
+            HSCPP_DLOG(Error, "hyperscan does not support this platform!");
+            munmap(map, file_size);
+            return HS_ARCH_ERROR;
+        }
+
+        // patterns are loaded into one store, so large sets don't cost an object each.
+        PatternStore loaded;
+        loaded.reserve(header.pattern_count, header.meta_size);
+        const char *pos = base + sizeof(header);
+        const char *meta_end = pos + header.meta_size;
+        for (uint32_t i = 0; i < header.pattern_count; i++)
+        {
+            // sizes are compared with what is left, a crafted one can't wrap a pointer past the end.
+            DbFilePattern rec;
+            if (pos > meta_end || sizeof(rec) > static_cast<size_t>(meta_end - pos))
+            {
+                break;
+            }
+            memcpy(&rec, pos, sizeof(rec));
+            pos += sizeof(rec);
+            if (rec.expr_len > static_cast<size_t>(meta_end - pos))
+            {
+                break;
+            }
+            loaded.AddBytes(pos, rec.expr_len, rec.id, rec.flag, rec.literal != 0);
+            loaded.SetCapture(rec.capture != 0);
+            if (rec.has_ext)
+            {
+                hs_expr_ext_t ext;
+                ext.flags = rec.ext_flags;
+                ext.min_offset = rec.min_offset;
+                ext.max_offset = rec.max_offset;
+                ext.min_length = rec.min_length;
+                ext.edit_distance = rec.edit_distance;
+                ext.hamming_distance = rec.hamming_distance;
+                loaded.SetExFlag(ext);
+            }
+            pos += Align8(rec.expr_len);
+        }
+        if (loaded.size() != header.pattern_count)
+        {
+            HSCPP_DLOG(Error, "truncated pattern records in database file %s", path.c_str());
+            munmap(map, file_size);
+            return HS_INVALID;
+        }
+
+        auto gen = std::make_shared<HsDatabase>();
+        gen->mode = header.compile_mode;
+        pos = meta_end;
+        const char *db_end = meta_end + header.db_size;
+        int ret = HS_SUCCESS;
+        for (uint32_t i = 0; i < header.db_count && ret == HS_SUCCESS; i++)
+        {
+            uint64_t len = 0;
+            if (pos > db_end || sizeof(len) > static_cast<size_t>(db_end - pos))
+            {
+                ret = HS_INVALID;
+                break;
+            }
+            memcpy(&len, pos, sizeof(len));
+            pos += sizeof(len);
+            if (len > static_cast<uint64_t>(db_end - pos))
+            {
+                ret = HS_INVALID;
+                break;
+            }
+            hs_database_t *loaded_db = nullptr;
+            ret = hs_deserialize_database(pos, len, &loaded_db);
+            if (ret == HS_SUCCESS)
+            {
+                gen->dbs.push_back(loaded_db);
+            }
+            pos += Align8(len);
+        }
+        munmap(map, file_size);
+        if (ret != HS_SUCCESS || gen->dbs.empty())
+        {
+            HSCPP_DLOG(Error, "hs deserialize error! error no is%d", ret);
+            return ret != HS_SUCCESS ? ret : HS_INVALID;
+        }
+
+        gen->stores.push_back(std::make_shared<PatternStore>(std::move(loaded)));
+        std::vector<PatternRef> refs;
+        CollectRefs(gen->patterns, gen->stores, refs);
+        gen->index.Build(refs);
+        std::unique_lock<std::mutex> lock(mtx);
+        CompileOptions opts = options;
+        lock.unlock();
+        ret = BuildConfirms(refs, opts, *gen);
+        if (ret != HS_SUCCESS)
+        {
+            return ret;
+        }
+        gen->scratch.reset(new Scratch(gen->dbs));
+
+        lock.lock();
+        options.mode = header.compile_mode;
+        options.shards = header.db_count;
+        patterns.clear();
+        stores = gen->stores;
+        requested++;
+        Publish(gen, requested);
+        return HS_SUCCESS;
+    }
+}
@@ -0,0 +1,248 @@
+#include "hs_stats.h"
+#include <sstream>
+
+namespace Echidna
+{
+    namespace
+    {
+        const char *KIND_NAMES[] = {"match", "safe_match", "stream", "compile"};
+
+        std::atomic<uint32_t> next_shard(0);
+    }
+
+    HitCounters::HitCounters(const std::vector<uint32_t> &uids, uint32_t shards)
+        : ids(uids),
+          // rows are padded to cache lines.
+          stride(static_cast<uint32_t>((uids.size() + 7) / 8 * 8)),
+          counts(new std::atomic<uint64_t>[static_cast<size_t>(stride) * shards])
+    {
+        for (size_t i = 0; i < static_cast<size_t>(stride) * shards; i++)
+        {
+            counts[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t HitCounters::Sum(uint32_t slot, uint32_t shards) const
+    {
+        uint64_t sum = 0;
+        for (uint32_t i = 0; i < shards; i++)
+        {
+            sum += counts[static_cast<size_t>(i) * stride + slot].load(std::memory_order_relaxed);
+        }
+        return sum;
+    }
+
+    uint64_t LatencySnapshot::Quantile(double q) const
+    {
+        if (!count)
+        {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(q * count);
+        uint64_t seen = 0;
+        for (auto &&bucket : buckets)
+        {
+            seen += bucket.second;
+            if (seen > rank)
+            {
+                return bucket.first;
+            }
+        }
+        return buckets.empty() ? 0 : buckets.back().first;
+    }
+
+    HsStats::HsStats() : enabled(false) {}
+
+    void HsStats::Enable(bool on)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (on && !shards)
+        {
+            shards.reset(new Counters[SHARDS]);
+            for (uint32_t i = 0; i < SHARDS; i++)
+            {
+                for (size_t k = 0; k < KINDS; k++)
+                {
+                    shards[i].operations[k].store(0, std::memory_order_relaxed);
+                    shards[i].bytes[k].store(0, std::memory_order_relaxed);
+                    shards[i].sum[k].store(0, std::memory_order_relaxed);
+                    for (uint32_t b = 0; b < BUCKETS; b++)
+                    {
+                        shards[i].buckets[k][b].store(0, std::memory_order_relaxed);
+                    }
+                }
+            }
+        }
+        enabled.store(on, std::memory_order_release);
+    }
+
+    uint32_t HsStats::Shard()
+    {
+        thread_local uint32_t shard = next_shard++ % SHARDS;
+        return shard;
+    }
+
+    uint32_t HsStats::Bucket(uint64_t ns)
+    {
+        if (ns < (1u << SUB_BITS))
+        {
+            return static_cast<uint32_t>(ns);
+        }
+        uint32_t bits = 63 - static_cast<uint32_t>(__builtin_clzll(ns));
+        if (bits > MAX_BITS)
+        {
+            return BUCKETS - 1;
+        }
+        uint32_t sub = static_cast<uint32_t>(ns >> (bits - SUB_BITS)) & ((1u << SUB_BITS) - 1);
+        return ((bits - SUB_BITS + 1) << SUB_BITS) + sub;
+    }
+
+    uint64_t HsStats::BucketLimit(uint32_t bucket)
+    {
+        if (bucket < (1u << SUB_BITS))
+        {
+            return bucket;
+        }
+        uint32_t bits = (bucket >> SUB_BITS) + SUB_BITS - 1;
+        uint64_t sub = bucket & ((1u << SUB_BITS) - 1);
+        // the largest value in the bucket.
+        return (((1ull << SUB_BITS) + sub + 1) << (bits - SUB_BITS)) - 1;
+    }
+
+    void HsStats::Record(StatsKind kind, size_t bytes, uint64_t ns)
+    {
+        if (!Enabled())
+        {
+            return;
+        }
+        size_t k = static_cast<size_t>(kind);
+        auto &shard = shards[Shard()];
+        shard.operations[k].fetch_add(1, std::memory_order_relaxed);
+        shard.bytes[k].fetch_add(bytes, std::memory_order_relaxed);
+        shard.sum[k].fetch_add(ns, std::memory_order_relaxed);
+        shard.buckets[k][Bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void HsStats::Attach(const HitCounters *hits)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        live.push_back(hits);
+    }
+
+    void HsStats::Retire(const HitCounters *hits)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (size_t i = 0; i < live.size(); i++)
+        {
+            if (live[i] == hits)
+            {
+                live[i] = live.back();
+                live.pop_back();
+                break;
+            }
+        }
+        for (uint32_t slot = 0; slot < hits->ids.size(); slot++)
+        {
+            retired[hits->ids[slot]] += hits->Sum(slot, SHARDS);
+        }
+    }
+
+    StatsSnapshot HsStats::Snapshot()
+    {
+        StatsSnapshot snap;
+        std::lock_guard<std::mutex> lock(mtx);
+        for (size_t k = 0; k < KINDS; k++)
+        {
+            snap.operations[k] = 0;
+            snap.bytes[k] = 0;
+            snap.latency[k].count = 0;
+            snap.latency[k].sum = 0;
+            if (!shards)
+            {
+                continue;
+            }
+            for (uint32_t i = 0; i < SHARDS; i++)
+            {
+                snap.operations[k] += shards[i].operations[k].load(std::memory_order_relaxed);
+                snap.bytes[k] += shards[i].bytes[k].load(std::memory_order_relaxed);
+                snap.latency[k].sum += shards[i].sum[k].load(std::memory_order_relaxed);
+            }
+            for (uint32_t b = 0; b < BUCKETS; b++)
+            {
+                uint64_t count = 0;
+                for (uint32_t i = 0; i < SHARDS; i++)
+                {
+                    count += shards[i].buckets[k][b].load(std::memory_order_relaxed);
+                }
+                if (count)
+                {
+                    snap.latency[k].buckets.push_back(std::make_pair(BucketLimit(b), count));
+                    snap.latency[k].count += count;
+                }
+            }
+        }
+
+        snap.hits = retired;
+        for (auto &&hits : live)
+        {
+            for (uint32_t slot = 0; slot < hits->ids.size(); slot++)
+            {
+                snap.hits[hits->ids[slot]] += hits->Sum(slot, SHARDS);
+            }
+        }
+        return snap;
+    }
+
+    std::string HsStats::Prometheus(const std::string &prefix)
+    {
+        auto snap = Snapshot();
+        std::ostringstream out;
+
+        out << "# HELP " << prefix << "_operations_total Number of scans and compiles.\n";
+        out << "# TYPE " << prefix << "_operations_total counter\n";
+        for (size_t k = 0; k < KINDS; k++)
+        {
+            out << prefix << "_operations_total{op=\"" << KIND_NAMES[k] << "\"} " << snap.operations[k] << "\n";
+        }
+
+        out << "# HELP " << prefix << "_scanned_bytes_total Number of bytes scanned.\n";
+        out << "# TYPE " << prefix << "_scanned_bytes_total counter\n";
+        for (size_t k = 0; k < KINDS; k++)
+        {
+            if (static_cast<StatsKind>(k) != StatsKind::compile)
+            {
+                out << prefix << "_scanned_bytes_total{op=\"" << KIND_NAMES[k] << "\"} " << snap.bytes[k] << "\n";
+            }
+        }
+
+        // the fine buckets are folded into powers of two from 1us, so the series stay the same across scrapes.
+        out << "# HELP " << prefix << "_duration_seconds Latency of scans and compiles.\n";
+        out << "# TYPE " << prefix << "_duration_seconds histogram\n";
+        for (size_t k = 0; k < KINDS; k++)
+        {
+            auto &latency = snap.latency[k];
+            size_t next = 0;
+            uint64_t cumulative = 0;
+            for (uint32_t bits = 10; bits <= MAX_BITS; bits++)
+            {
+                uint64_t limit = 1ull << bits;
+                while (next < latency.buckets.size() && latency.buckets[next].first < limit)
+                {
+                    cumulative += latency.buckets[next++].second;
+                }
+                out << prefix << "_duration_seconds_bucket{op=\"" << KIND_NAMES[k] << "\",le=\"" << limit / 1e9 << "\"} " << cumulative << "\n";
+            }
+            out << prefix << "_duration_seconds_bucket{op=\"" << KIND_NAMES[k] << "\",le=\"+Inf\"} " << latency.count << "\n";
+            out << prefix << "_duration_seconds_sum{op=\"" << KIND_NAMES[k] << "\"} " << latency.sum / 1e9 << "\n";
+            out << prefix << "_duration_seconds_count{op=\"" << KIND_NAMES[k] << "\"} " << latency.count << "\n";
+        }
+
+        out << "# HELP " << prefix << "_pattern_hits_total Number of hits by pattern id.\n";
+        out << "# TYPE " << prefix << "_pattern_hits_total counter\n";
+        for (auto &&hit : snap.hits)
+        {
+            out << prefix << "_pattern_hits_total{id=\"" << hit.first << "\"} " << hit.second << "\n";
+        }
+        return out.str();
+    }
+}
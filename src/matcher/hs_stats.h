@@ -0,0 +1,168 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace Echidna
+{
+    /**
+     * the operations @ref HsStats counts and times.
+     */
+    enum class StatsKind
+    {
+        match,
+        safe_match,
+        stream,
+        compile
+    };
+
+    /**
+     * a latency histogram read from @ref HsStats, in nanoseconds.
+     */
+    struct LatencySnapshot
+    {
+        uint64_t count;
+        uint64_t sum;
+        // (upper bound, count) of the buckets that are not empty, in order.
+        std::vector<std::pair<uint64_t, uint64_t>> buckets;
+
+        /**
+         * the latency that q (0 to 1) of the operations are faster than, within 12.5%.
+         */
+        uint64_t Quantile(double q) const;
+    };
+
+    /**
+     * everything @ref HsStats has counted, read at once.
+     */
+    struct StatsSnapshot
+    {
+        constexpr static size_t KINDS = 4;
+
+        // indexed by @ref StatsKind.
+        uint64_t operations[KINDS];
+        uint64_t bytes[KINDS];
+        LatencySnapshot latency[KINDS];
+        // hits of every pattern by id, including the ones removed since.
+        std::map<uint32_t, uint64_t> hits;
+    };
+
+    /**
+     * hit counters of the patterns of one generation, one row per shard of threads, indexed by the slot
+     * of the pattern in its @ref PatternIndex. Generally users don't need to care it.
+     */
+    struct HitCounters
+    {
+        std::vector<uint32_t> ids;
+        uint32_t stride;
+        std::unique_ptr<std::atomic<uint64_t>[]> counts;
+        HitCounters(const std::vector<uint32_t> &uids, uint32_t shards);
+        uint64_t Sum(uint32_t slot, uint32_t shards) const;
+    };
+
+    /**
+     * it counts what a matcher does: operations, bytes and latency by @ref StatsKind, and hits by pattern.
+     *
+     * Counters are sharded by thread and summed when they are read, so threads don't share cache lines to
+     * count. Nothing is allocated or counted until it is enabled, scans only check one flag then.
+     */
+    class HsStats
+    {
+    public:
+        constexpr static uint32_t SHARDS = 8;
+        // 8 buckets per power of two, up to 2^40 ns.
+        constexpr static uint32_t SUB_BITS = 3;
+        constexpr static uint32_t MAX_BITS = 40;
+        constexpr static uint32_t BUCKETS = (MAX_BITS - SUB_BITS + 2) << SUB_BITS;
+
+        HsStats();
+        HsStats(const HsStats &) = delete;
+        HsStats &operator=(const HsStats &) = delete;
+
+        bool Enabled() const { return enabled.load(std::memory_order_acquire); }
+        void Enable(bool on);
+
+        void Record(StatsKind kind, size_t bytes, uint64_t ns);
+
+        /**
+         * start and stop counting the hits of a generation, the counts are kept when it is gone.
+         */
+        void Attach(const HitCounters *hits);
+        void Retire(const HitCounters *hits);
+
+        StatsSnapshot Snapshot();
+
+        /**
+         * the snapshot in the Prometheus text exposition format.
+         *
+         * @param prefix
+         *      the prefix of every metric name.
+         */
+        std::string Prometheus(const std::string &prefix = "hscpp");
+
+        /**
+         * the shard of the calling thread.
+         */
+        static uint32_t Shard();
+
+        static uint32_t Bucket(uint64_t ns);
+        static uint64_t BucketLimit(uint32_t bucket);
+
+    private:
+        constexpr static size_t KINDS = StatsSnapshot::KINDS;
+
+        struct Counters
+        {
+            std::atomic<uint64_t> operations[KINDS];
+            std::atomic<uint64_t> bytes[KINDS];
+            std::atomic<uint64_t> sum[KINDS];
+            std::atomic<uint64_t> buckets[KINDS][BUCKETS];
+        };
+
+        std::atomic<bool> enabled;
+        std::unique_ptr<Counters[]> shards;
+        // mtx guards the counters of live generations and the hits of the retired ones.
+        std::mutex mtx;
+        std::vector<const HitCounters *> live;
+        std::map<uint32_t, uint64_t> retired;
+    };
+
+    using HsStatsPtr = std::shared_ptr<HsStats>;
+
+    /**
+     * it records the time from its construction to its destruction, if stats are enabled.
+     */
+    class StatsTimer
+    {
+    public:
+        StatsTimer(HsStats *ustats, StatsKind ukind, size_t ubytes = 0)
+            : bytes(ubytes), stats(ustats && ustats->Enabled() ? ustats : nullptr), kind(ukind)
+        {
+            if (stats)
+            {
+                start = std::chrono::steady_clock::now();
+            }
+        }
+        ~StatsTimer()
+        {
+            if (stats)
+            {
+                auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+                stats->Record(kind, bytes, static_cast<uint64_t>(ns));
+            }
+        }
+        bool Active() const { return stats != nullptr; }
+
+        size_t bytes;
+
+    private:
+        HsStats *stats;
+        StatsKind kind;
+        std::chrono::steady_clock::time_point start;
+    };
+}
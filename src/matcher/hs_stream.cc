@@ -0,0 +1,264 @@
+#include "hs_stream.h"
+#include <algorithm>
+#include <limits>
+#include "debug_log.h"
+
+namespace Echidna
+{
+    HsStream::HsStream(HsMatcher &umatcher, UserCtx *uctx)
+        : matcher(umatcher),
+          cb_handler(umatcher.cb_handler),
+          ctx(uctx),
+          offset(0),
+          stopped(StopReason::none) {}
+
+    HsStream::HsStream(HsMatcher &umatcher, MatchCb cb, UserCtx *uctx)
+        : matcher(umatcher),
+          cb_handler(cb),
+          ctx(uctx),
+          offset(0),
+          stopped(StopReason::none) {}
+
+    HsStream::~HsStream()
+    {
+        if (IsOpen())
+        {
+            Close();
+        }
+    }
+
+    int HsStream::Open()
+    {
+        if (IsOpen())
+        {
+            HSCPP_DLOG(Warning, "stream is already open!");
+            return HS_INVALID;
+        }
+
+        gen = matcher.Acquire();
+        if (!gen)
+        {
+            return HS_INVALID;
+        }
+
+        if (!(gen->mode & HS_MODE_STREAM))
+        {
+            HSCPP_DLOG(Error, "the matcher is not in stream mode, open stream failed!");
+            gen.reset();
+            return HS_DB_MODE_ERROR;
+        }
+
+        int ret = HS_SUCCESS;
+        for (auto &&db : gen->dbs)
+        {
+            hs_stream_t *stream = nullptr;
+            ret = hs_open_stream(db, 0, &stream);
+            if (ret != HS_SUCCESS)
+            {
+                break;
+            }
+            streams.push_back(stream);
+        }
+        if (ret != HS_SUCCESS)
+        {
+            HSCPP_DLOG(Error, "hs open stream error! error no is%d", ret);
+            for (auto &&stream : streams)
+            {
+                hs_close_stream(stream, nullptr, nullptr, nullptr);
+            }
+            streams.clear();
+            gen.reset();
+        }
+        offset = 0;
+        stopped = StopReason::none;
+        return ret;
+    }
+
+    int HsStream::Write(const char *data, size_t len)
+    {
+        if (!IsOpen())
+        {
+            HSCPP_DLOG(Warning, "write to a stream which is not open!");
+            return HS_INVALID;
+        }
+        if (stopped != StopReason::none)
+        {
+            return HS_SCAN_TERMINATED;
+        }
+
+        StatsTimer timer(gen->stats.get(), StatsKind::stream, len);
+        HsMatcher::HandlerCtx<MatchCb> scanctx{&cb_handler, ctx, &gen->index, gen->HitRow(), nullptr, 0};
+        uint32_t slot;
+        auto scr = gen->scratch->GetSafeScratch(slot);
+        int ret = HS_SUCCESS;
+        while (len && ret == HS_SUCCESS)
+        {
+            // hyperscan takes 32-bit lengths, larger chunks are split.
+            unsigned int piece = len > std::numeric_limits<unsigned int>::max() ? std::numeric_limits<unsigned int>::max() : static_cast<unsigned int>(len);
+            for (auto &&stream : streams)
+            {
+                ret = hs_scan_stream(stream, data, piece, 0, scr, HsMatcher::OnHit<MatchCb>, &scanctx);
+                if (ret != HS_SUCCESS)
+                {
+                    break;
+                }
+            }
+            data += piece;
+            len -= piece;
+            offset += piece;
+        }
+        gen->scratch->Release(slot);
+        return ret;
+    }
+
+    int HsStream::Write(const std::string &data)
+    {
+        return Write(data.data(), data.size());
+    }
+
+    ScanResult HsStream::Write(const char *data, size_t len, const ScanOptions &opts)
+    {
+        if (!IsOpen())
+        {
+            HSCPP_DLOG(Warning, "write to a stream which is not open!");
+            return ScanResult{HS_INVALID, StopReason::error, 0, 0};
+        }
+        if (stopped != StopReason::none)
+        {
+            return ScanResult{HS_SCAN_TERMINATED, stopped, 0, 0};
+        }
+
+        ScanBudget budget(opts);
+        MatchCb &handler = cb_handler;
+        auto limited = [&budget, &handler](unsigned int id, unsigned long long from, unsigned long long to, const UserCtx *mctx, const UserCtx *pctx) -> int
+        {
+            return budget.Hit(id, handler(id, from, to, mctx, pctx));
+        };
+        using Limited = decltype(limited);
+
+        StatsTimer timer(gen->stats.get(), StatsKind::stream, len);
+        HsMatcher::HandlerCtx<Limited> scanctx{&limited, ctx, &gen->index, gen->HitRow(), nullptr, 0};
+        uint32_t slot;
+        auto scr = gen->scratch->GetSafeScratch(slot);
+        size_t chunk = opts.chunk ? std::min<size_t>(opts.chunk, std::numeric_limits<unsigned int>::max()) : std::numeric_limits<unsigned int>::max();
+        int ret = HS_SUCCESS;
+        while (len && ret == HS_SUCCESS && !budget.Stopped())
+        {
+            if (budget.Expired())
+            {
+                budget.Stop(StopReason::time_budget);
+                break;
+            }
+            auto piece = static_cast<unsigned int>(budget.Take(std::min(len, chunk)));
+            if (!piece)
+            {
+                break;
+            }
+            for (auto &&stream : streams)
+            {
+                ret = hs_scan_stream(stream, data, piece, 0, scr, HsMatcher::OnHit<Limited>, &scanctx);
+                if (ret != HS_SUCCESS)
+                {
+                    break;
+                }
+            }
+            data += piece;
+            len -= piece;
+            offset += piece;
+        }
+        gen->scratch->Release(slot);
+        ScanResult result = budget.Result(ret);
+        if (result.ret == HS_SCAN_TERMINATED)
+        {
+            // the streams aren't terminated when a byte or time budget stops between chunks, a later write
+            // would match across the skipped bytes.
+            stopped = result.reason;
+        }
+        return result;
+    }
+
+    int HsStream::Close()
+    {
+        if (!IsOpen())
+        {
+            return HS_INVALID;
+        }
+
+        if (stopped != StopReason::none)
+        {
+            // the end of data of a stopped stream isn't the end of the written data.
+            for (auto &&stream : streams)
+            {
+                hs_close_stream(stream, nullptr, nullptr, nullptr);
+            }
+            streams.clear();
+            gen.reset();
+            stopped = StopReason::none;
+            return HS_SUCCESS;
+        }
+
+        HsMatcher::HandlerCtx<MatchCb> scanctx{&cb_handler, ctx, &gen->index, gen->HitRow(), nullptr, 0};
+        uint32_t slot;
+        auto scr = gen->scratch->GetSafeScratch(slot);
+        int ret = HS_SUCCESS;
+        for (auto &&stream : streams)
+        {
+            auto res = hs_close_stream(stream, scr, HsMatcher::OnHit<MatchCb>, &scanctx);
+            if (res != HS_SUCCESS)
+            {
+                ret = res;
+            }
+        }
+        gen->scratch->Release(slot);
+        streams.clear();
+        gen.reset();
+        return ret;
+    }
+
+    int HsStream::Reset()
+    {
+        if (!IsOpen())
+        {
+            return HS_INVALID;
+        }
+
+        // the matcher has been recompiled, move to its new database.
+        if (std::atomic_load(&matcher.current) != gen)
+        {
+            Close();
+            return Open();
+        }
+
+        if (stopped != StopReason::none)
+        {
+            int ret = HS_SUCCESS;
+            for (auto &&stream : streams)
+            {
+                auto res = hs_reset_stream(stream, 0, nullptr, nullptr, nullptr);
+                if (res != HS_SUCCESS)
+                {
+                    ret = res;
+                }
+            }
+            offset = 0;
+            stopped = StopReason::none;
+            return ret;
+        }
+
+        HsMatcher::HandlerCtx<MatchCb> scanctx{&cb_handler, ctx, &gen->index, gen->HitRow(), nullptr, 0};
+        uint32_t slot;
+        auto scr = gen->scratch->GetSafeScratch(slot);
+        int ret = HS_SUCCESS;
+        for (auto &&stream : streams)
+        {
+            auto res = hs_reset_stream(stream, 0, scr, HsMatcher::OnHit<MatchCb>, &scanctx);
+            if (res != HS_SUCCESS)
+            {
+                ret = res;
+            }
+        }
+        gen->scratch->Release(slot);
+        offset = 0;
+        return ret;
+    }
+}
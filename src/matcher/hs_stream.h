@@ -0,0 +1,108 @@
+#pragma once
+#include "hs_matcher.h"
+
+namespace Echidna
+{
+    /**
+     * it implements a hyperscan stream on a streaming @ref HsMatcher.
+     *
+     * Data can be written chunk by chunk as it arrives, and matches are reported at offsets counted from
+     * the start of the stream, as if all the chunks were scanned in one piece. A stream only keeps a fixed
+     * size state, no matter how much data has been written.
+     *
+     * The matcher must be set to @ref HsMatcher::MatchMode::stream, and must outlive the stream. A stream keeps
+     * scanning with the database it was opened with, patterns changed later are used after @ref Reset().
+     * A stream is not thread safe, but different streams of one matcher can be used in different threads.
+     */
+    class HsStream
+    {
+    public:
+        HsStream() = delete;
+        HsStream(const HsStream &) = delete;
+        HsStream &operator=(const HsStream &) = delete;
+
+        /**
+         * @param matcher
+         *      the streaming matcher to scan with.
+         * @param ctx
+         *      it will be passed to the callback function if hit.
+         */
+        HsStream(HsMatcher &matcher, UserCtx *ctx = nullptr);
+
+        /**
+         * @param matcher
+         *      the streaming matcher to scan with.
+         * @param cb
+         *      it will be called instead of the one registed to the matcher when hit.
+         * @param ctx
+         *      it will be passed to the callback function if hit.
+         */
+        HsStream(HsMatcher &matcher, MatchCb cb, UserCtx *ctx = nullptr);
+
+        /**
+         * The stream will be closed if it is still open, and end-of-data matches will be reported.
+         */
+        ~HsStream();
+
+        /**
+         * Open the stream. The matcher database will be compiled if needed.
+         *
+         * @return HS_SUCCESS or a hyperscan error code.
+         */
+        int Open();
+
+        /**
+         * Scan the next chunk of the stream.
+         *
+         * @return HS_SUCCESS, HS_SCAN_TERMINATED if the callback asked to stop or the stream is stopped, or a
+         *      hyperscan error code.
+         */
+        int Write(const char *data, size_t len);
+        int Write(const std::string &data);
+
+        /**
+         * Scan the next chunk of the stream within limits, see @ref ScanOptions. The data is scanned
+         * opts.chunk bytes at a time and the time budget is checked between them. The limits apply to this
+         * write only. When one is reached the rest of the data is not scanned and the stream is stopped: the
+         * skipped bytes leave a gap a match can't span, so every later write returns HS_SCAN_TERMINATED
+         * without scanning until @ref Reset(), as hyperscan does once a callback stops a stream. Close() and
+         * Reset() of a stopped stream report no end-of-data matches either.
+         *
+         * @return what the write did and why it stopped, see @ref ScanResult.
+         */
+        ScanResult Write(const char *data, size_t len, const ScanOptions &opts);
+
+        /**
+         * Close the stream, matches that can only be confirmed at the end of data will be reported.
+         */
+        int Close();
+
+        /**
+         * Report the end-of-data matches, and restart the stream at offset 0. The stream is not reallocated
+         * unless the matcher has been recompiled since it was opened.
+         */
+        int Reset();
+
+        bool IsOpen() const { return !streams.empty(); }
+
+        /**
+         * why a budgeted write stopped the stream, StopReason::none if it is not stopped.
+         */
+        StopReason Stopped() const { return stopped; }
+
+        /**
+         * the number of bytes written since the stream was opened or reset.
+         */
+        unsigned long long Offset() const { return offset; }
+
+    private:
+        HsMatcher &matcher;
+        MatchCb cb_handler;
+        UserCtx *ctx;
+        HsDatabasePtr gen;
+        // one stream per shard of the database.
+        std::vector<hs_stream_t *> streams;
+        unsigned long long offset;
+        StopReason stopped;
+    };
+}
@@ -0,0 +1,191 @@
+#include "pattern_confirm.h"
+#include <limits>
+#include <stdlib.h>
+#include "debug_log.h"
+
+namespace Echidna
+{
+    namespace
+    {
+        constexpr unsigned int UNBOUNDED = std::numeric_limits<unsigned int>::max();
+
+        /**
+         * the expression as ECMAScript, anchored at the end of the searched range. The dot is written out,
+         * since std::regex has no dotall flag and its dot doesn't match \r either. The anchor is a lookahead
+         * rather than $, so that $ in the expression still fails before the end of the data.
+         */
+        std::string Translate(const PatternRef &pat)
+        {
+            std::string expr("(?:");
+            expr.reserve(pat.len + 8);
+            bool in_class = false;
+            for (size_t i = 0; i < pat.len; i++)
+            {
+                char c = pat.expr[i];
+                if (c == '\\' && i + 1 < pat.len)
+                {
+                    expr.push_back(c);
+                    expr.push_back(pat.expr[++i]);
+                    continue;
+                }
+                if (in_class)
+                {
+                    in_class = c != ']';
+                }
+                else if (c == '[')
+                {
+                    in_class = true;
+                    // a ] right after [ or [^ is a member, not the end of the class.
+                    expr.push_back(c);
+                    if (i + 1 < pat.len && pat.expr[i + 1] == '^')
+                    {
+                        expr.push_back(pat.expr[++i]);
+                    }
+                    if (i + 1 < pat.len && pat.expr[i + 1] == ']')
+                    {
+                        expr.push_back(pat.expr[++i]);
+                    }
+                    continue;
+                }
+                else if (c == '.')
+                {
+                    expr.append((pat.flag & HS_FLAG_DOTALL) ? "[\\s\\S]" : "[^\\n]");
+                    continue;
+                }
+                expr.push_back(c);
+            }
+            expr.append(")(?![\\s\\S])");
+            return expr;
+        }
+    }
+
+    std::unique_ptr<PatternConfirm> PatternConfirm::Create(const PatternRef &pat, size_t window, bool pass, std::string &error)
+    {
+        if (pat.literal || (pat.flag & HS_FLAG_COMBINATION))
+        {
+            error = "literals and combinations have no regex";
+            return nullptr;
+        }
+        if (pat.flag & HS_FLAG_MULTILINE)
+        {
+            error = "multiline is not supported by std::regex";
+            return nullptr;
+        }
+        if (pat.ext && (pat.ext->flags & (HS_EXT_FLAG_EDIT_DISTANCE | HS_EXT_FLAG_HAMMING_DISTANCE)))
+        {
+            error = "approximate matching can't be confirmed";
+            return nullptr;
+        }
+
+        std::unique_ptr<PatternConfirm> confirm(new PatternConfirm());
+        confirm->prefilter = (pat.flag & HS_FLAG_PREFILTER) != 0;
+        confirm->leftmost = (pat.flag & HS_FLAG_SOM_LEFTMOST) != 0;
+        confirm->window = window;
+        confirm->pass = pass;
+        auto syntax = std::regex_constants::ECMAScript | std::regex_constants::optimize;
+        if (pat.flag & HS_FLAG_CASELESS)
+        {
+            syntax |= std::regex_constants::icase;
+        }
+        try
+        {
+            confirm->re.assign(Translate(pat), syntax);
+        }
+        catch (const std::regex_error &e)
+        {
+            error = e.what();
+            return nullptr;
+        }
+
+        // with the prefilter flag this is the width of the approximation hyperscan compiles, which matches
+        // everything the pattern does.
+        hs_expr_info_t *info = nullptr;
+        hs_compile_error_t *err = nullptr;
+        if (hs_expression_ext_info(pat.expr, pat.flag, pat.ext, &info, &err) == HS_SUCCESS)
+        {
+            confirm->width = info->max_width;
+            free(info);
+        }
+        else
+        {
+            confirm->width = UNBOUNDED;
+            hs_free_compile_error(err);
+        }
+        return confirm;
+    }
+
+    bool PatternConfirm::Search(const char *data, size_t len, unsigned long long from, unsigned long long to, std::cmatch &found, bool &cut) const
+    {
+        size_t end = to < len ? static_cast<size_t>(to) : len;
+        size_t start = 0;
+        if (leftmost && from <= end)
+        {
+            // the leftmost start of the approximation is never after the start of a real match.
+            start = static_cast<size_t>(from);
+        }
+        else if (width != UNBOUNDED && width < end)
+        {
+            start = end - width;
+        }
+        cut = false;
+        if (end - start > window)
+        {
+            start = end - window;
+            cut = true;
+        }
+
+        auto flags = std::regex_constants::match_default;
+        if (start)
+        {
+            // ^ and \b at the start of the window look at the byte before it.
+            flags |= std::regex_constants::match_prev_avail;
+        }
+        if (end < len && !(end + 1 == len && data[end] == '\n'))
+        {
+            // $ in the expression only matches at the end of the data, or before a newline that ends it.
+            flags |= std::regex_constants::match_not_eol;
+        }
+        try
+        {
+            return std::regex_search(data + start, data + end, found, re, flags);
+        }
+        catch (const std::regex_error &e)
+        {
+            HSCPP_DLOG(Warning, "regex confirm error! %s", e.what());
+            cut = true;
+            return false;
+        }
+    }
+
+    bool PatternConfirm::Confirm(const char *data, size_t len, unsigned long long from, unsigned long long to) const
+    {
+        std::cmatch found;
+        bool cut = false;
+        return Search(data, len, from, to, found, cut) || (cut && pass);
+    }
+
+    bool PatternConfirm::Extract(const char *data, size_t len, unsigned long long from, unsigned long long to, std::vector<Capture> &groups) const
+    {
+        groups.clear();
+        std::cmatch found;
+        bool cut = false;
+        if (!Search(data, len, from, to, found, cut))
+        {
+            return false;
+        }
+        groups.reserve(found.size());
+        for (size_t i = 0; i < found.size(); i++)
+        {
+            if (found[i].matched)
+            {
+                groups.push_back(Capture{static_cast<unsigned long long>(found[i].first - data),
+                                         static_cast<unsigned long long>(found[i].second - data), true});
+            }
+            else
+            {
+                groups.push_back(Capture{0, 0, false});
+            }
+        }
+        return true;
+    }
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <regex>
+#include <memory>
+#include <string>
+#include <vector>
+#include "pattern_store.h"
+
+namespace Echidna
+{
+    /**
+     * one capture group of a hit, see @ref HsMatcher::Captures(). Offsets are counted from the start of the
+     * scanned data.
+     */
+    struct Capture
+    {
+        unsigned long long from;
+        unsigned long long to;
+        // false if the group took no part in the match, from and to are 0 then.
+        bool matched;
+    };
+
+    /**
+     * a backtracking regex (std::regex, ECMAScript) of one pattern, generally users don't need to care it.
+     * It confirms the candidate hits of a prefilter pattern, and pulls capture groups out of hits.
+     *
+     * Hyperscan reports where a match ends, so the regex is anchored there and only searches the longest
+     * match of the pattern before it, or from the start of the hit with the leftmost flag. std::regex is
+     * quadratic and recursive, so the search never looks further back than a window: when a match may
+     * start before it and none is found inside, the hit can't be told and it is passed or dropped as set.
+     * It is immutable and can be shared by threads.
+     */
+    class PatternConfirm
+    {
+    public:
+        /**
+         * build the regex of a pattern, it returns nullptr and the reason if std::regex can't take it, e.g.
+         * for lookbehinds, the multiline flag or approximate matching.
+         *
+         * @param window
+         *      bytes before the end of a hit to search at most, a byte of window takes a few hundred bytes
+         *      of stack at worst.
+         * @param pass
+         *      whether a hit that can't be told within the window is passed or dropped.
+         */
+        static std::unique_ptr<PatternConfirm> Create(const PatternRef &pat, size_t window, bool pass, std::string &error);
+
+        /**
+         * true if hits have to be confirmed, i.e. the pattern is compiled with the prefilter flag.
+         */
+        bool Prefilter() const { return prefilter; }
+
+        /**
+         * true if the pattern really matches the data at a match that ends at to, from is only used with
+         * the leftmost flag.
+         */
+        bool Confirm(const char *data, size_t len, unsigned long long from, unsigned long long to) const;
+
+        /**
+         * the capture groups of the match that ends at to, group 0 is the whole match. It returns false if
+         * there is no such match within the window.
+         */
+        bool Extract(const char *data, size_t len, unsigned long long from, unsigned long long to, std::vector<Capture> &groups) const;
+
+    private:
+        PatternConfirm() : width(0), window(0), prefilter(false), leftmost(false), pass(false) {}
+
+        /**
+         * it returns false if there is no match, and sets cut if a match may start before the window.
+         */
+        bool Search(const char *data, size_t len, unsigned long long from, unsigned long long to, std::cmatch &found, bool &cut) const;
+
+        std::regex re;
+        // the longest match, UINT_MAX if unbounded.
+        unsigned int width;
+        size_t window;
+        bool prefilter;
+        bool leftmost;
+        bool pass;
+    };
+}
@@ -0,0 +1,80 @@
+#include "pattern_index.h"
+#include "debug_log.h"
+
+namespace Echidna
+{
+    PatternIndex::PatternIndex()
+        : mask(0), shift(31), muted_count(0) {}
+
+    void PatternIndex::clear()
+    {
+        entries.clear();
+        table.clear();
+        mask = 0;
+        shift = 31;
+        muted.reset();
+        muted_count = 0;
+    }
+
+    void PatternIndex::Mute(uint32_t slot, bool mute)
+    {
+        if (slot >= entries.size())
+        {
+            return;
+        }
+        uint64_t bit = 1ull << (slot & 63);
+        if (mute)
+        {
+            if (!(muted[slot >> 6].fetch_or(bit) & bit))
+            {
+                muted_count++;
+            }
+        }
+        else if (muted[slot >> 6].fetch_and(~bit) & bit)
+        {
+            muted_count--;
+        }
+    }
+
+    void PatternIndex::Build(const std::vector<PatternRef> &patterns)
+    {
+        clear();
+        entries.reserve(patterns.size());
+
+        // keep the load factor under 1/2, so probe sequences stay short.
+        size_t capacity = 2;
+        shift = 31;
+        while (capacity < patterns.size() * 2)
+        {
+            capacity <<= 1;
+            shift--;
+        }
+        table.assign(capacity, 0);
+        mask = static_cast<uint32_t>(capacity - 1);
+
+        for (auto &&i : patterns)
+        {
+            uint32_t id = i.id;
+            if (Find(id))
+            {
+                HSCPP_DLOG(Warning, "duplicate pattern id in matcher:%u", id);
+                continue;
+            }
+            entries.push_back(PatternEntry{id, i.ctx, nullptr});
+
+            uint32_t pos = Hash(id) >> shift;
+            while (table[pos])
+            {
+                pos = (pos + 1) & mask;
+            }
+            table[pos] = static_cast<uint32_t>(entries.size());
+        }
+
+        size_t words = entries.size() / 64 + 1;
+        muted.reset(new std::atomic<uint64_t>[words]);
+        for (size_t i = 0; i < words; i++)
+        {
+            muted[i].store(0, std::memory_order_relaxed);
+        }
+    }
+}
@@ -0,0 +1,119 @@
+#pragma once
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+#include "pattern_store.h"
+#include "ctx.h"
+
+namespace Echidna
+{
+    class PatternConfirm;
+
+    /**
+     * one resolved pattern of a compiled database, generally users don't need to care it.
+     */
+    struct PatternEntry
+    {
+        uint32_t id;
+        const UserCtx *ctx;
+        // the regex that confirms hits or extracts captures, nullptr for most patterns.
+        const PatternConfirm *confirm;
+    };
+
+    /**
+     * it maps a pattern id reported by hyperscan to its pattern in O(1), generally users don't need to care it.
+     *
+     * Entries are stored densely by slot, and an open-addressing table (linear probing) maps ids to slots.
+     * It is rebuilt together with the database, so it never changes while scanning, but for one bit per
+     * slot that mutes a pattern.
+     */
+    class PatternIndex
+    {
+    public:
+        PatternIndex();
+
+        /**
+         * rebuild the index from the given patterns. Slots follow the order of the patterns.
+         */
+        void Build(const std::vector<PatternRef> &patterns);
+
+        /**
+         * the entry of the pattern with the given id, or nullptr if there is none.
+         */
+        inline const PatternEntry *Find(uint32_t id) const
+        {
+            if (table.empty())
+            {
+                return nullptr;
+            }
+            for (uint32_t pos = Hash(id) >> shift;; pos = (pos + 1) & mask)
+            {
+                uint32_t slot = table[pos];
+                if (!slot)
+                {
+                    return nullptr;
+                }
+                if (entries[slot - 1].id == id)
+                {
+                    return &entries[slot - 1];
+                }
+            }
+        }
+
+        /**
+         * the dense slot of an entry returned by @ref Find(), from 0 to size() - 1.
+         */
+        inline uint32_t Slot(const PatternEntry *entry) const
+        {
+            return static_cast<uint32_t>(entry - entries.data());
+        }
+
+        const PatternEntry &At(uint32_t slot) const { return entries[slot]; }
+
+        /**
+         * attach the regex of the pattern in a slot, before the index is used to scan.
+         */
+        void SetConfirm(uint32_t slot, const PatternConfirm *confirm) { entries[slot].confirm = confirm; }
+
+        /**
+         * mute or unmute the pattern in a slot, it is safe while other threads scan.
+         */
+        void Mute(uint32_t slot, bool mute);
+
+        /**
+         * true if hits of the pattern in the slot are to be dropped.
+         */
+        inline bool Muted(uint32_t slot) const
+        {
+            // a matcher with nothing muted doesn't touch the bits at all.
+            if (!muted_count.load(std::memory_order_relaxed))
+            {
+                return false;
+            }
+            return (muted[slot >> 6].load(std::memory_order_relaxed) >> (slot & 63)) & 1;
+        }
+
+        size_t size() const { return entries.size(); }
+        void clear();
+
+    private:
+        /**
+         * fibonacci hashing, the slot is taken from the top bits, since the low bits of the product only
+         * depend on the low bits of the id.
+         */
+        static inline uint32_t Hash(uint32_t id)
+        {
+            return id * 0x9E3779B1u;
+        }
+
+        std::vector<PatternEntry> entries;
+        // slot + 1 of the entry, 0 means empty.
+        std::vector<uint32_t> table;
+        uint32_t mask;
+        // 32 - log2 of the table size.
+        uint32_t shift;
+        std::unique_ptr<std::atomic<uint64_t>[]> muted;
+        std::atomic<uint32_t> muted_count;
+    };
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Echidna
+{
+    /**
+     * how @ref HsMatcher::Profile() measures the patterns.
+     */
+    struct ProfileOptions
+    {
+        // a sample of the traffic to scan, nullptr only measures compiling. Up to 4GB of it is scanned.
+        const char *corpus;
+        size_t corpus_len;
+        // scans of the corpus per group, the fastest one counts.
+        uint32_t repeat;
+        // patterns measured together, in the order they were added. 1 measures every pattern on its own,
+        // larger groups make a first pass over a large rule set faster.
+        size_t group;
+
+        ProfileOptions() : corpus(nullptr), corpus_len(0), repeat(3), group(1) {}
+    };
+
+    /**
+     * what one pattern, or one group of patterns, costs when it is compiled and scanned on its own.
+     */
+    struct PatternCost
+    {
+        std::vector<uint32_t> ids;
+        // the expression of the first pattern.
+        std::string expr;
+        // HS_SUCCESS, or the error of compiling, the log tells the reason.
+        int ret;
+        // shortest and longest match, from hs_expression_info. max_width is UINT_MAX if unbounded.
+        unsigned int min_width;
+        unsigned int max_width;
+        uint64_t compile_ns;
+        // hs_database_size of the databases.
+        size_t db_size;
+        // hs_stream_size of the databases, 0 unless the matcher is in stream mode.
+        size_t stream_size;
+        // the fastest scan of the corpus, and the hits in it.
+        uint64_t scan_ns;
+        uint64_t hits;
+
+        PatternCost()
+            : ret(0), min_width(0), max_width(0), compile_ns(0), db_size(0), stream_size(0), scan_ns(0), hits(0) {}
+    };
+
+    /**
+     * the costs of a rule set, see @ref HsMatcher::Profile().
+     */
+    struct ProfileResult
+    {
+        // all patterns compiled as the matcher does, widths are not set.
+        PatternCost total;
+        // patterns that failed to compile first, then the costliest: by scan time, compile time, and
+        // database size.
+        std::vector<PatternCost> patterns;
+    };
+
+    /**
+     * a ranked text table of a profile, one line per pattern or group.
+     *
+     * @param top
+     *      lines to print at most, 0 prints all.
+     */
+    std::string ProfileReport(const ProfileResult &result, size_t top = 0);
+}
@@ -0,0 +1,69 @@
+#include "result_buffer.h"
+#include <algorithm>
+#include <string.h>
+
+namespace Echidna
+{
+    ResultBuffer::ResultBuffer(size_t capacity, Overflow policy, bool udedup)
+        : froms(nullptr),
+          tos(nullptr),
+          ids(nullptr),
+          cap(0),
+          used(0),
+          dropped(0),
+          overflow(policy),
+          dedup(udedup),
+          epoch(0)
+    {
+        reserve(capacity);
+    }
+
+    void ResultBuffer::reserve(size_t hits)
+    {
+        if (hits <= cap)
+        {
+            return;
+        }
+
+        std::unique_ptr<char[]> grown(new char[hits * (2 * sizeof(unsigned long long) + sizeof(uint32_t))]);
+        auto nfroms = reinterpret_cast<unsigned long long *>(grown.get());
+        auto ntos = nfroms + hits;
+        auto nids = reinterpret_cast<uint32_t *>(ntos + hits);
+        if (used)
+        {
+            memcpy(nfroms, froms, used * sizeof(unsigned long long));
+            memcpy(ntos, tos, used * sizeof(unsigned long long));
+            memcpy(nids, ids, used * sizeof(uint32_t));
+        }
+        block.swap(grown);
+        froms = nfroms;
+        tos = ntos;
+        ids = nids;
+        cap = hits;
+    }
+
+    void ResultBuffer::clear()
+    {
+        used = 0;
+        dropped = 0;
+    }
+
+    void ResultBuffer::Begin(size_t patterns)
+    {
+        clear();
+        if (!dedup)
+        {
+            return;
+        }
+        if (stamps.size() < patterns)
+        {
+            stamps.resize(patterns, 0);
+        }
+        // stamps of old scans would look new once the epoch wraps, start over.
+        if (++epoch == 0)
+        {
+            std::fill(stamps.begin(), stamps.end(), 0);
+            epoch = 1;
+        }
+    }
+}
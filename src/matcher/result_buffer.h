@@ -0,0 +1,134 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Echidna
+{
+    /**
+     * a reusable collector of hits for @ref HsMatcher::MatchInto(), instead of a callback that pushes hits
+     * into a vector.
+     *
+     * Hits are kept as a structure of arrays: ids, start and end offsets each live in their own contiguous
+     * array, all carved from one block, so downstream code can loop over one column at a time. The block is
+     * kept across scans, a buffer that is reused does not allocate once it is large enough.
+     *
+     * With dedup on, only the first hit of each pattern is kept. It is tracked with one stamp per pattern
+     * that is bumped per scan, so starting a scan does not clear anything.
+     *
+     * A buffer is not thread safe, use one buffer per thread.
+     */
+    class ResultBuffer
+    {
+    public:
+        /**
+         * what to do with a hit when the buffer is full.
+         */
+        enum class Overflow
+        {
+            // double the buffer, it is the only case a scan allocates.
+            grow,
+            // drop the hit and keep scanning, see @ref Dropped().
+            drop,
+            // stop the scan, MatchInto() returns HS_SCAN_TERMINATED.
+            stop
+        };
+
+        /**
+         * @param capacity
+         *      number of hits to hold before the overflow policy applies.
+         * @param overflow
+         *      see @ref Overflow.
+         * @param dedup
+         *      keep only the first hit of each pattern.
+         */
+        explicit ResultBuffer(size_t capacity = 1024, Overflow overflow = Overflow::grow, bool dedup = false);
+        ResultBuffer(const ResultBuffer &) = delete;
+        ResultBuffer &operator=(const ResultBuffer &) = delete;
+
+        void SetOverflow(Overflow policy) { overflow = policy; }
+        void SetDedup(bool on) { dedup = on; }
+
+        /**
+         * make room for the given number of hits, hits already in the buffer are kept.
+         */
+        void reserve(size_t hits);
+
+        /**
+         * drop the hits, the memory is kept for the next scan.
+         */
+        void clear();
+
+        size_t size() const { return used; }
+        bool empty() const { return !used; }
+        size_t capacity() const { return cap; }
+
+        /**
+         * columns of the hits, size() entries each, in the order hyperscan reported them. They are valid
+         * until the next scan or @ref reserve().
+         */
+        const uint32_t *Ids() const { return ids; }
+        const unsigned long long *Froms() const { return froms; }
+        const unsigned long long *Tos() const { return tos; }
+
+        /**
+         * hits lost to a full buffer in the last scan, with @ref Overflow::drop or @ref Overflow::stop.
+         */
+        size_t Dropped() const { return dropped; }
+
+        /**
+         * start a scan of a database with the given number of patterns, generally users don't need to
+         * care it.
+         */
+        void Begin(size_t patterns);
+
+        /**
+         * add a hit of the pattern in the given slot of the database, generally users don't need to care it.
+         * It returns non-zero when the scan has to stop.
+         */
+        inline int Add(uint32_t slot, uint32_t id, unsigned long long from, unsigned long long to)
+        {
+            if (dedup)
+            {
+                if (stamps[slot] == epoch)
+                {
+                    return 0;
+                }
+                stamps[slot] = epoch;
+            }
+            if (used == cap)
+            {
+                if (overflow == Overflow::grow)
+                {
+                    reserve(cap ? cap * 2 : 64);
+                }
+                else
+                {
+                    dropped++;
+                    return overflow == Overflow::stop;
+                }
+            }
+            ids[used] = id;
+            froms[used] = from;
+            tos[used] = to;
+            used++;
+            return 0;
+        }
+
+    private:
+        // froms, then tos, then ids, of cap entries each.
+        std::unique_ptr<char[]> block;
+        unsigned long long *froms;
+        unsigned long long *tos;
+        uint32_t *ids;
+        size_t cap;
+        size_t used;
+        size_t dropped;
+        Overflow overflow;
+        bool dedup;
+        // the epoch of the scan that saw the pattern in the slot.
+        std::vector<uint32_t> stamps;
+        uint32_t epoch;
+    };
+}
@@ -0,0 +1,35 @@
+#include "scan_budget.h"
+#include <hs/hs.h>
+
+namespace Echidna
+{
+    ScanBudget::ScanBudget(const ScanOptions &opts)
+        : opts(opts), reason(StopReason::none), truncated(false), hits(0), bytes(0)
+    {
+        if (opts.time_budget.count())
+        {
+            start = std::chrono::steady_clock::now();
+        }
+    }
+
+    size_t ScanBudget::Take(size_t len)
+    {
+        if (opts.byte_budget && len > opts.byte_budget - bytes)
+        {
+            len = opts.byte_budget - bytes;
+            truncated = true;
+        }
+        bytes += len;
+        return len;
+    }
+
+    ScanResult ScanBudget::Result(int ret) const
+    {
+        if (ret != HS_SUCCESS && ret != HS_SCAN_TERMINATED)
+        {
+            return ScanResult{ret, StopReason::error, hits, bytes};
+        }
+        StopReason why = (reason == StopReason::none && truncated) ? StopReason::byte_budget : reason;
+        return ScanResult{why == StopReason::none ? HS_SUCCESS : HS_SCAN_TERMINATED, why, hits, bytes};
+    }
+}
@@ -0,0 +1,137 @@
+#pragma once
+#include <chrono>
+#include <unordered_set>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Echidna
+{
+    /**
+     * why a scan with @ref ScanOptions stopped.
+     */
+    enum class StopReason
+    {
+        // all the data was scanned.
+        none,
+        // max_hits hits were reported.
+        hit_limit,
+        // a pattern of stop_ids hit.
+        stop_id,
+        // the callback returned non-zero.
+        callback,
+        // the scan took longer than time_budget.
+        time_budget,
+        // the data was longer than byte_budget, the rest is not scanned.
+        byte_budget,
+        // the scan failed, see @ref ScanResult::ret.
+        error
+    };
+
+    /**
+     * limits of one scan, the default ones scan everything. A scan stops at the first limit reached.
+     */
+    struct ScanOptions
+    {
+        // stop after this many hits, 1 answers "does anything match?" at the cost of the first hit. 0 means
+        // no limit.
+        size_t max_hits;
+        // stop after a hit of one of these patterns.
+        std::unordered_set<uint32_t> stop_ids;
+        // stop once the scan takes longer than this, 0 means no limit. It is checked on every hit and between
+        // the chunks of a stream write, a block without hits is always scanned to its end.
+        std::chrono::nanoseconds time_budget;
+        // scan at most this many bytes, 0 means no limit.
+        size_t byte_budget;
+        // stream writes are scanned in chunks of this size, so that time_budget is checked between them.
+        size_t chunk;
+
+        ScanOptions() : max_hits(0), time_budget(0), byte_budget(0), chunk(64 * 1024) {}
+    };
+
+    /**
+     * what a scan with @ref ScanOptions did.
+     */
+    struct ScanResult
+    {
+        // HS_SUCCESS, HS_SCAN_TERMINATED if it stopped early, or the error of hyperscan.
+        int ret;
+        StopReason reason;
+        // hits passed to the callback.
+        size_t hits;
+        // bytes scanned.
+        size_t bytes;
+    };
+
+    /**
+     * the running state of one scan with @ref ScanOptions, generally users don't need to care it.
+     */
+    class ScanBudget
+    {
+    public:
+        explicit ScanBudget(const ScanOptions &opts);
+
+        /**
+         * count a hit that was passed to the callback, which returned ret. It returns non-zero when the scan
+         * has to stop.
+         */
+        inline int Hit(uint32_t id, int ret)
+        {
+            hits++;
+            if (ret)
+            {
+                return Stop(StopReason::callback);
+            }
+            if (opts.max_hits && hits >= opts.max_hits)
+            {
+                return Stop(StopReason::hit_limit);
+            }
+            if (!opts.stop_ids.empty() && opts.stop_ids.count(id))
+            {
+                return Stop(StopReason::stop_id);
+            }
+            if (Expired())
+            {
+                return Stop(StopReason::time_budget);
+            }
+            return 0;
+        }
+
+        /**
+         * how many of the next len bytes may be scanned, the scan ends with @ref StopReason::byte_budget
+         * if it is less than len and nothing else stops it first.
+         */
+        size_t Take(size_t len);
+
+        inline bool Expired() const
+        {
+            return opts.time_budget.count() && std::chrono::steady_clock::now() - start > opts.time_budget;
+        }
+
+        /**
+         * record why the scan stops, the first reason wins. It returns non-zero, for callbacks.
+         */
+        inline int Stop(StopReason why)
+        {
+            if (reason == StopReason::none)
+            {
+                reason = why;
+            }
+            return 1;
+        }
+
+        bool Stopped() const { return reason != StopReason::none; }
+
+        /**
+         * the result of the scan that returned ret.
+         */
+        ScanResult Result(int ret) const;
+
+    private:
+        const ScanOptions &opts;
+        std::chrono::steady_clock::time_point start;
+        StopReason reason;
+        bool truncated;
+        size_t hits;
+        size_t bytes;
+    };
+}
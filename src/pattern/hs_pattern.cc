@@ -10,7 +10,10 @@ namespace Echidna
     {
         id = IdGenerator.GetID();
         flag = 0;
-        userctx = std::make_shared<UserCtx>(*ctx);
+        if (ctx)
+        {
+            userctx = std::make_shared<UserCtx>(*ctx);
+        }
     }
 
     Hs_Pattern::Hs_Pattern(const std::string &pat, uint32_t uid, UserCtx *ctx)
@@ -24,13 +27,16 @@ namespace Echidna
         {
             if (!IdGenerator.SetID(uid))
             {
-                DLogger.DLog(LogType::Error, "to large or duplicate id:" + std::to_string(uid) + " -> " + pat);
+                HSCPP_DLOG(Error, "to large or duplicate id:%u -> %s", uid, pat.c_str());
                 exit(0);
             }
             id = uid;
         }
         flag = 0;
-        userctx = std::make_shared<UserCtx>(*ctx);
+        if (ctx)
+        {
+            userctx = std::make_shared<UserCtx>(*ctx);
+        }
     }
 
     Hs_Pattern::Hs_Pattern(const std::string &pat, uint32_t uid, uint32_t uflag, UserCtx *ctx)
@@ -44,13 +50,32 @@ namespace Echidna
         {
             if (!IdGenerator.SetID(uid))
             {
-                DLogger.DLog(LogType::Error, "too large id or duplicate id:" + std::to_string(uid) + " -> " + pat);
+                HSCPP_DLOG(Error, "too large id or duplicate id:%u -> %s", uid, pat.c_str());
                 exit(0);
             }
             id = uid;
         }
         flag = uflag;
-        userctx = std::make_shared<UserCtx>(*ctx);
+        if (ctx)
+        {
+            userctx = std::make_shared<UserCtx>(*ctx);
+        }
+    }
+
+    Hs_Pattern::Hs_Pattern(const std::string &pat, uint32_t uid, uint32_t uflag, ExFlagPtr ext)
+        : Pattern(pat), id(uid), flag(uflag), ex_flag(ext)
+    {
+        IdGenerator.SetID(uid);
+    }
+
+    std::shared_ptr<Hs_Pattern> Hs_Pattern::Restore(const std::string &expr, uint32_t id, uint32_t flag, const hs_expr_ext_t *ext)
+    {
+        ExFlagPtr ex_flag;
+        if (ext)
+        {
+            ex_flag = std::make_shared<hs_expr_ext_t>(*ext);
+        }
+        return std::shared_ptr<Hs_Pattern>(new Hs_Pattern(expr, id, flag, ex_flag));
     }
 
     const std::string &Hs_Pattern::Get()
@@ -68,7 +93,7 @@ namespace Echidna
         flag &= ~static_cast<int>(uflag);
     }
 
-    void InitExFlag(std::shared_ptr<hs_expr_ext_t> ex_flag)
+    void InitExFlag(std::shared_ptr<hs_expr_ext_t> &ex_flag)
     {
         ex_flag = std::make_shared<hs_expr_ext_t>();
         ex_flag->flags = 0;
@@ -117,7 +142,7 @@ namespace Echidna
         }
         if (edit_distance > EDIT_DISTANCE_MAX)
         {
-            DLogger.DLog(LogType::Warning, " performance may be low, due to large edit_distance:" + std::to_string(edit_distance));
+            HSCPP_DLOG(Warning, " performance may be low, due to large edit_distance:%u", edit_distance);
         }
         ex_flag->edit_distance = edit_distance;
         ex_flag->flags |= HS_EXT_FLAG_EDIT_DISTANCE;
@@ -131,7 +156,7 @@ namespace Echidna
         }
         if (hamming_distance > EDIT_DISTANCE_MAX)
         {
-            DLogger.DLog(LogType::Warning, " performance may be low, due to large hamming_distance:" + std::to_string(hamming_distance));
+            HSCPP_DLOG(Warning, " performance may be low, due to large hamming_distance:%u", hamming_distance);
         }
         ex_flag->hamming_distance = hamming_distance;
         ex_flag->flags |= HS_EXT_FLAG_HAMMING_DISTANCE;
@@ -59,11 +59,41 @@ namespace Echidna
         void Set_edit_distance(unsigned int);
         void Set_hamming_distance(unsigned int);
 
+        /**
+         * Mark the expression as a literal: every byte of it, NUL and regex metacharacters included, is matched
+         * as it is. Literals are compiled into their own database, which is much faster to build and smaller
+         * than the same strings written as regex. Only the caseless, singlematch and leftmost flags apply to
+         * them, and extended parameters are not supported.
+         */
+        void SetLiteral(bool literal = true) { this->literal = literal; }
+        bool IsLiteral() { return literal; }
+
+        /**
+         * Mark the pattern for capture extraction, see @ref HsMatcher::Captures(). Hyperscan doesn't report
+         * capture groups, so a backtracking regex of the pattern is built as well, which takes ECMAScript
+         * syntax. Patterns with the prefilter flag get one anyway, to confirm their hits.
+         */
+        void SetCapture(bool capture = true) { this->capture = capture; }
+        bool IsCapture() { return capture; }
+
+        /**
+         * Rebuild a pattern that was saved before, e.g. by @ref HsMatcher::Save(). The id is kept as it is,
+         * and it is not an error if the id is already in use, since it is the same pattern.
+         *
+         * @param ext
+         *      the extended parameters, or nullptr if there are none.
+         */
+        static std::shared_ptr<Hs_Pattern> Restore(const std::string &expr, uint32_t id, uint32_t flag, const hs_expr_ext_t *ext);
+
     private:
+        Hs_Pattern(const std::string &, uint32_t id, uint32_t flag, ExFlagPtr ext);
+
         uint32_t id;
         uint32_t flag;
         ExFlagPtr ex_flag;
         CtxPtr userctx;
+        bool literal = false;
+        bool capture = false;
     };
 
     using HsPatPtr = std::shared_ptr<Hs_Pattern>;
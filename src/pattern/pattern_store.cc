@@ -0,0 +1,266 @@
+#include "pattern_store.h"
+#include "unique_id.h"
+#include <algorithm>
+#include <string.h>
+
+namespace Echidna
+{
+    constexpr size_t PatternStore::npos;
+    constexpr uint8_t PatternStore::LITERAL;
+    constexpr uint8_t PatternStore::REMOVED;
+    constexpr uint8_t PatternStore::CAPTURE;
+    constexpr uint32_t PatternStore::ID_BLOCK;
+
+    namespace
+    {
+        template <typename T>
+        const T *Lookup(const std::vector<std::pair<uint32_t, T>> &items, uint32_t slot)
+        {
+            auto it = std::lower_bound(items.begin(), items.end(), slot,
+                                       [](const std::pair<uint32_t, T> &item, uint32_t s)
+                                       { return item.first < s; });
+            return (it != items.end() && it->first == slot) ? &it->second : nullptr;
+        }
+
+        template <typename T>
+        size_t Capacity(const std::vector<T> &items)
+        {
+            return items.capacity() * sizeof(T);
+        }
+    }
+
+    PatternStore::PatternStore()
+        : removed(0), next_id(0), end_id(0), indexed(0) {}
+
+    PatternStore::PatternStore(PatternStore &&other)
+        : removed(0), next_id(0), end_id(0), indexed(0)
+    {
+        *this = std::move(other);
+    }
+
+    PatternStore &PatternStore::operator=(PatternStore &&other)
+    {
+        if (this != &other)
+        {
+            bytes.swap(other.bytes);
+            offsets.swap(other.offsets);
+            ids.swap(other.ids);
+            flags.swap(other.flags);
+            kinds.swap(other.kinds);
+            exts.swap(other.exts);
+            ctxs.swap(other.ctxs);
+            std::swap(removed, other.removed);
+            std::swap(next_id, other.next_id);
+            std::swap(end_id, other.end_id);
+            index.swap(other.index);
+            std::swap(indexed, other.indexed);
+            other.clear();
+        }
+        return *this;
+    }
+
+    void PatternStore::clear()
+    {
+        bytes.clear();
+        offsets.clear();
+        ids.clear();
+        flags.clear();
+        kinds.clear();
+        exts.clear();
+        ctxs.clear();
+        removed = 0;
+        index.clear();
+        indexed = 0;
+    }
+
+    void PatternStore::reserve(size_t patterns, size_t len)
+    {
+        bytes.reserve(len + patterns);
+        offsets.reserve(patterns);
+        ids.reserve(patterns);
+        flags.reserve(patterns);
+        kinds.reserve(patterns);
+    }
+
+    uint32_t PatternStore::AddBytes(const char *expr, size_t len, uint32_t id, uint32_t flag, bool literal)
+    {
+        if (id == AUTOID)
+        {
+            if (next_id == end_id)
+            {
+                next_id = IdGenerator.GetIDs(ID_BLOCK);
+                end_id = next_id + ID_BLOCK;
+            }
+            id = next_id++;
+        }
+        offsets.push_back(bytes.size());
+        bytes.insert(bytes.end(), expr, expr + len);
+        bytes.push_back('\0');
+        ids.push_back(id);
+        flags.push_back(flag);
+        kinds.push_back(literal ? LITERAL : 0);
+        return id;
+    }
+
+    uint32_t PatternStore::Add(const char *expr, uint32_t id, uint32_t flag, bool literal)
+    {
+        return AddBytes(expr, strlen(expr), id, flag, literal);
+    }
+
+    uint32_t PatternStore::Add(const std::string &expr, uint32_t id, uint32_t flag, bool literal)
+    {
+        return AddBytes(expr.data(), expr.size(), id, flag, literal);
+    }
+
+    void PatternStore::SetExFlag(const hs_expr_ext_t &ext)
+    {
+        if (ids.empty())
+        {
+            return;
+        }
+        uint32_t slot = static_cast<uint32_t>(ids.size() - 1);
+        if (!exts.empty() && exts.back().first == slot)
+        {
+            exts.back().second = ext;
+            return;
+        }
+        exts.push_back(std::make_pair(slot, ext));
+    }
+
+    void PatternStore::SetCtx(CtxPtr ctx)
+    {
+        if (ids.empty())
+        {
+            return;
+        }
+        uint32_t slot = static_cast<uint32_t>(ids.size() - 1);
+        if (!ctxs.empty() && ctxs.back().first == slot)
+        {
+            ctxs.back().second = ctx;
+            return;
+        }
+        ctxs.push_back(std::make_pair(slot, ctx));
+    }
+
+    void PatternStore::SetCapture(bool capture)
+    {
+        if (ids.empty())
+        {
+            return;
+        }
+        if (capture)
+        {
+            kinds.back() |= CAPTURE;
+        }
+        else
+        {
+            kinds.back() &= ~CAPTURE;
+        }
+    }
+
+    bool PatternStore::Remove(uint32_t id)
+    {
+        size_t slot = Find(id);
+        if (slot == npos)
+        {
+            return false;
+        }
+        kinds[slot] |= REMOVED;
+        removed++;
+        return true;
+    }
+
+    PatternStore PatternStore::Clone() const
+    {
+        PatternStore copy;
+        copy.bytes = bytes;
+        copy.offsets = offsets;
+        copy.ids = ids;
+        copy.flags = flags;
+        copy.kinds = kinds;
+        copy.exts = exts;
+        copy.ctxs = ctxs;
+        copy.removed = removed;
+        return copy;
+    }
+
+    PatternRef PatternStore::At(size_t i) const
+    {
+        uint32_t slot = static_cast<uint32_t>(i);
+        auto ctx = Lookup(ctxs, slot);
+        size_t end = i + 1 < offsets.size() ? offsets[i + 1] : bytes.size();
+        return PatternRef{bytes.data() + offsets[i], end - offsets[i] - 1, ids[i], flags[i],
+                          (kinds[i] & LITERAL) != 0, (kinds[i] & CAPTURE) != 0, Lookup(exts, slot), ctx ? ctx->get() : nullptr};
+    }
+
+    size_t PatternStore::Find(uint32_t id) const
+    {
+        // by id, and by slot for duplicate ids so that the first one is found first.
+        auto before = [this](uint32_t a, uint32_t b)
+        {
+            return ids[a] != ids[b] ? ids[a] < ids[b] : a < b;
+        };
+        std::lock_guard<std::mutex> lock(index_mtx);
+        if (indexed < ids.size())
+        {
+            // only the patterns added since the last call are sorted, then merged.
+            index.reserve(ids.size());
+            for (size_t i = indexed; i < ids.size(); i++)
+            {
+                index.push_back(static_cast<uint32_t>(i));
+            }
+            std::sort(index.begin() + indexed, index.end(), before);
+            std::inplace_merge(index.begin(), index.begin() + indexed, index.end(), before);
+            indexed = ids.size();
+        }
+        auto it = std::lower_bound(index.begin(), index.end(), id,
+                                   [this](uint32_t slot, uint32_t i)
+                                   { return ids[slot] < i; });
+        for (; it != index.end() && ids[*it] == id; ++it)
+        {
+            if (!(kinds[*it] & REMOVED))
+            {
+                return *it;
+            }
+        }
+        return npos;
+    }
+
+    size_t PatternStore::MemoryUsage() const
+    {
+        std::lock_guard<std::mutex> lock(index_mtx);
+        return sizeof(*this) + Capacity(bytes) + Capacity(offsets) + Capacity(ids) + Capacity(flags) +
+               Capacity(kinds) + Capacity(exts) + Capacity(ctxs) + Capacity(index);
+    }
+
+    PatternRef Ref(Hs_Pattern &pat)
+    {
+        const std::string &expr = pat.Get();
+        return PatternRef{expr.c_str(), expr.size(), pat.GetId(), pat.GetFlag(), pat.IsLiteral(), pat.IsCapture(), pat.GetExFlag().get(), pat.GetUerCtx()};
+    }
+
+    void CollectRefs(const std::vector<PatPtr> &patterns, const std::vector<PatternStorePtr> &stores, std::vector<PatternRef> &refs)
+    {
+        size_t total = patterns.size();
+        for (auto &&store : stores)
+        {
+            total += store->Live();
+        }
+        refs.clear();
+        refs.reserve(total);
+        for (auto &&i : patterns)
+        {
+            refs.push_back(Ref(*dynamic_cast<Hs_Pattern *>(i.get())));
+        }
+        for (auto &&store : stores)
+        {
+            for (size_t i = 0; i < store->size(); i++)
+            {
+                if (!store->Removed(i))
+                {
+                    refs.push_back(store->At(i));
+                }
+            }
+        }
+    }
+}
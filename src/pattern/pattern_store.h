@@ -0,0 +1,153 @@
+#pragma once
+#include <hs/hs.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <stdint.h>
+#include "hs_pattern.h"
+#include "ctx.h"
+
+namespace Echidna
+{
+    /**
+     * a read-only view of one pattern, either an @ref Hs_Pattern or a pattern of a @ref PatternStore,
+     * generally users don't need to care it. It is valid as long as the pattern it points to.
+     */
+    struct PatternRef
+    {
+        // NUL terminated, len doesn't count the NUL.
+        const char *expr;
+        size_t len;
+        uint32_t id;
+        uint32_t flag;
+        bool literal;
+        bool capture;
+        const hs_expr_ext_t *ext;
+        const UserCtx *ctx;
+    };
+
+    /**
+     * Compact storage for very large pattern sets, e.g. millions of IOC strings, added to a matcher at once
+     * by @ref HsMatcher::push_back(PatternStore &&).
+     *
+     * All expressions live in one contiguous buffer and ids, flags and kinds in plain arrays, extended
+     * parameters and user-contexts are only kept for the patterns that have them. A pattern costs its bytes
+     * plus about 24 bytes, instead of several objects and allocations for an @ref Hs_Pattern.
+     *
+     * AUTOID hands out consecutive ids from blocks reserved in the global id generator at once. Explicit ids
+     * are not registered there, a duplicate id is reported when the matcher compiles and only the first
+     * pattern with it gets its user-context. It is move-only, copy it with @ref Clone().
+     */
+    class PatternStore
+    {
+    public:
+        PatternStore();
+        PatternStore(PatternStore &&other);
+        PatternStore &operator=(PatternStore &&other);
+        PatternStore(const PatternStore &) = delete;
+        PatternStore &operator=(const PatternStore &) = delete;
+
+        /**
+         * reserve room for the given number of patterns and expression bytes in total.
+         */
+        void reserve(size_t patterns, size_t bytes);
+
+        /**
+         * Add a pattern.
+         *
+         * @param id
+         *      the pattern id, or AUTOID to get a unique one.
+         * @param flag
+         *      hyperscan flags, like @ref Hs_Pattern::FLAG.
+         * @param literal
+         *      match the expression byte for byte, see @ref Hs_Pattern::SetLiteral().
+         * @return the id of the pattern.
+         */
+        uint32_t Add(const char *expr, uint32_t id = AUTOID, uint32_t flag = 0, bool literal = false);
+        uint32_t Add(const std::string &expr, uint32_t id = AUTOID, uint32_t flag = 0, bool literal = false);
+
+        /**
+         * Add a pattern of len bytes, e.g. a literal with NULs. It has its own name, so that Add("expr", 6)
+         * still means id 6.
+         */
+        uint32_t AddBytes(const char *expr, size_t len, uint32_t id = AUTOID, uint32_t flag = 0, bool literal = false);
+
+        /**
+         * set the extended parameters or the user-context of the pattern added last.
+         */
+        void SetExFlag(const hs_expr_ext_t &ext);
+        void SetCtx(CtxPtr ctx);
+
+        /**
+         * mark the pattern added last for capture extraction, see @ref Hs_Pattern::SetCapture().
+         */
+        void SetCapture(bool capture = true);
+
+        /**
+         * remove the pattern with the given id, it returns false if there is none.
+         */
+        bool Remove(uint32_t id);
+
+        PatternStore Clone() const;
+        void clear();
+
+        /**
+         * number of slots, removed patterns included, and number of patterns left.
+         */
+        size_t size() const { return ids.size(); }
+        size_t Live() const { return ids.size() - removed; }
+        bool empty() const { return !Live(); }
+
+        PatternRef At(size_t i) const;
+        bool Removed(size_t i) const { return (kinds[i] & REMOVED) != 0; }
+
+        /**
+         * the slot of the pattern with the given id, or npos. The ids are indexed on the first call after
+         * patterns are added.
+         */
+        size_t Find(uint32_t id) const;
+        static constexpr size_t npos = static_cast<size_t>(-1);
+
+        /**
+         * bytes held by the store.
+         */
+        size_t MemoryUsage() const;
+
+    private:
+        static constexpr uint8_t LITERAL = 1;
+        static constexpr uint8_t REMOVED = 2;
+        static constexpr uint8_t CAPTURE = 4;
+        // AUTOID ids reserved at a time.
+        static constexpr uint32_t ID_BLOCK = 4096;
+
+        // every expression followed by a NUL, offsets are where they start.
+        std::vector<char> bytes;
+        std::vector<size_t> offsets;
+        std::vector<uint32_t> ids;
+        std::vector<uint32_t> flags;
+        std::vector<uint8_t> kinds;
+        // sorted by slot, only for the patterns that have them.
+        std::vector<std::pair<uint32_t, hs_expr_ext_t>> exts;
+        std::vector<std::pair<uint32_t, CtxPtr>> ctxs;
+        size_t removed;
+        // the rest of the reserved id block.
+        uint32_t next_id;
+        uint32_t end_id;
+        // slots sorted by id, the slots from indexed on are not in it yet. Stores are shared by the
+        // generations of a matcher, so it is built under a lock.
+        mutable std::vector<uint32_t> index;
+        mutable size_t indexed;
+        mutable std::mutex index_mtx;
+    };
+
+    using PatternStorePtr = std::shared_ptr<const PatternStore>;
+
+    PatternRef Ref(Hs_Pattern &pat);
+
+    /**
+     * the views of the given patterns followed by the patterns left in the stores.
+     */
+    void CollectRefs(const std::vector<PatPtr> &patterns, const std::vector<PatternStorePtr> &stores, std::vector<PatternRef> &refs);
+}
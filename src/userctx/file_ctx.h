@@ -0,0 +1,22 @@
+#pragma once
+#include "ctx.h"
+#include <string>
+#include <stddef.h>
+
+namespace Echidna
+{
+    /**
+     * the context passed to the callback function when a file is matched, see HsMatcher::MatchFile().
+     */
+    class FileCtx : public UserCtx
+    {
+    public:
+        FileCtx(const std::string &upath, size_t usize, UserCtx *uctx)
+            : path(upath), size(usize), ctx(uctx) {}
+
+        std::string path;
+        size_t size;
+        // the context passed to MatchFile() or MatchTree().
+        UserCtx *ctx;
+    };
+}
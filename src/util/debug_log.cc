@@ -1,5 +1,7 @@
 #include "debug_log.h"
 #include <cstdlib>
+#include <cstdio>
+#include <chrono>
 
 #include <iostream>
 
@@ -35,14 +37,16 @@ namespace Echidna
     DebugLogger DLogger;
 
     DebugLogger::DebugLogger()
+        : enabled(false),
+          head(0),
+          tail(0),
+          dropped(0),
+          stop(false),
+          parked(false)
     {
         char *enable_log = getenv("HSCPP_DLOG_BOOL");
 
-        if (!enable_log)
-        {
-            enabled = false;
-        }
-        else
+        if (enable_log)
         {
             std::string log_bool(enable_log);
 
@@ -50,33 +54,185 @@ namespace Echidna
             {
                 enabled = bool_map[log_bool];
             }
-            else
-                enabled = false;
+        }
+
+        if (enabled)
+        {
+            ring.reset(new Entry[RING_SIZE]);
+            for (size_t i = 0; i < RING_SIZE; i++)
+            {
+                ring[i].seq.store(i, std::memory_order_relaxed);
+            }
         }
     }
 
-    void DebugLogger::DLog(LogType type, const std::string &msg)
+    DebugLogger::~DebugLogger()
     {
+        stop = true;
+        if (printer.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(park_mtx);
+                park_cv.notify_one();
+            }
+            printer.join();
+        }
+    }
+
+    void DebugLogger::Log(LogType type, const char *fmt, ...)
+    {
+        if (!enabled)
+        {
+            return;
+        }
+
+        va_list args;
+        va_start(args, fmt);
+        Push(type, fmt, args);
+        va_end(args);
+    }
 
+    void DebugLogger::DLog(LogType type, const std::string &msg)
+    {
         if (!enabled)
         {
             return;
         }
 
-        switch (type)
+        Log(type, "%s", msg.c_str());
+    }
+
+    void DebugLogger::Push(LogType type, const char *fmt, va_list args)
+    {
+        std::call_once(started, [this]
+                       { printer = std::thread(&DebugLogger::Loop, this); });
+
+        // a bounded multi-producer queue: a slot is free for position pos when its seq is pos.
+        uint64_t pos = head.load(std::memory_order_relaxed);
+        Entry *entry;
+        while (true)
+        {
+            entry = &ring[pos & (RING_SIZE - 1)];
+            uint64_t seq = entry->seq.load(std::memory_order_acquire);
+            int64_t diff = static_cast<int64_t>(seq - pos);
+            if (!diff)
+            {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            else
+            {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+
+        entry->type = type;
+        vsnprintf(entry->msg, MSG_SIZE, fmt, args);
+        entry->seq.store(pos + 1, std::memory_order_release);
+        Wake();
+    }
+
+    void DebugLogger::Wake()
+    {
+        // pairs with the fence in Loop(): either the printer sees the entry before it parks, or this sees
+        // it parked.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (parked.load(std::memory_order_relaxed))
+        {
+            std::lock_guard<std::mutex> lock(park_mtx);
+            park_cv.notify_one();
+        }
+    }
+
+    bool DebugLogger::Ready() const
+    {
+        uint64_t pos = tail.load(std::memory_order_relaxed);
+        return ring[pos & (RING_SIZE - 1)].seq.load(std::memory_order_acquire) == pos + 1;
+    }
+
+    bool DebugLogger::Print()
+    {
+        if (!Ready())
+        {
+            return false;
+        }
+        uint64_t pos = tail.load(std::memory_order_relaxed);
+        Entry &entry = ring[pos & (RING_SIZE - 1)];
+
+        switch (entry.type)
         {
         case (LogType::Error):
-            LightRed("<Error>: " + msg);
+            LightRed(std::string("<Error>: ") + entry.msg);
             break;
         case (LogType::Warning):
-            Red("<Warning>: " + msg);
+            Red(std::string("<Warning>: ") + entry.msg);
             break;
         case (LogType::Notice):
-            Blue("<Notice>: " + msg);
+            Blue(std::string("<Notice>: ") + entry.msg);
             break;
         case (LogType::Info):
-            Yellow("<Info>: " + msg);
+            Yellow(std::string("<Info>: ") + entry.msg);
             break;
         }
+
+        entry.seq.store(pos + RING_SIZE, std::memory_order_release);
+        tail.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    void DebugLogger::Loop()
+    {
+        uint64_t reported = 0;
+        while (true)
+        {
+            bool printed = false;
+            while (Print())
+            {
+                printed = true;
+            }
+
+            uint64_t lost = Dropped();
+            if (lost != reported)
+            {
+                Red("<Warning>: " + std::to_string(lost - reported) + " logs dropped, the log ring is full!");
+                reported = lost;
+            }
+
+            if (!printed)
+            {
+                if (stop)
+                {
+                    return;
+                }
+                parked.store(true, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                {
+                    std::unique_lock<std::mutex> lock(park_mtx);
+                    park_cv.wait(lock, [this]
+                                 { return stop || Ready(); });
+                }
+                parked.store(false, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void DebugLogger::Flush()
+    {
+        if (!enabled)
+        {
+            return;
+        }
+        uint64_t until = head.load(std::memory_order_acquire);
+        while (tail.load(std::memory_order_acquire) < until)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
     }
-}
\ No newline at end of file
+}
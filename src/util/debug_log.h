@@ -1,6 +1,34 @@
 #pragma once
 #include <string>
 #include <map>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <stdarg.h>
+#include <stdint.h>
+
+/**
+ * log types above this level are compiled out: 0 disables all logs, 1 keeps errors, 2 warnings too,
+ * 3 notices too and 4 (the default) keeps everything.
+ */
+#ifndef HSCPP_DLOG_LEVEL
+#define HSCPP_DLOG_LEVEL 4
+#endif
+
+/**
+ * log a printf-style message, e.g. HSCPP_DLOG(Error, "hs error %d", ret). If the type is compiled out or
+ * HSCPP_DLOG_BOOL is not set, nothing is formatted and the arguments are not even evaluated.
+ */
+#define HSCPP_DLOG(type, ...)                                                                                          \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        if (static_cast<int>(::Echidna::LogType::type) < HSCPP_DLOG_LEVEL && ::Echidna::DLogger.Enabled())            \
+        {                                                                                                              \
+            ::Echidna::DLogger.Log(::Echidna::LogType::type, __VA_ARGS__);                                             \
+        }                                                                                                              \
+    } while (0)
 
 namespace Echidna
 {
@@ -13,14 +41,64 @@ namespace Echidna
         Info
     };
 
+    /**
+     * it prints logs if HSCPP_DLOG_BOOL is set, use @ref HSCPP_DLOG to log.
+     *
+     * A log is formatted into a fixed size ring buffer and printed by a background thread, so logging
+     * never allocates nor waits for stdout. If the ring is full the log is dropped and counted.
+     */
     class DebugLogger
     {
     public:
+        // must be a power of 2.
+        constexpr static size_t RING_SIZE = 1024;
+        // longer messages are truncated.
+        constexpr static size_t MSG_SIZE = 244;
+
         DebugLogger();
+        ~DebugLogger();
+
+        bool Enabled() const { return enabled; }
+
+        void Log(LogType type, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
         void DLog(LogType type, const std::string &msg);
 
+        /**
+         * number of logs dropped because the ring was full.
+         */
+        uint64_t Dropped() const { return dropped.load(std::memory_order_relaxed); }
+
+        /**
+         * wait until every log before is printed.
+         */
+        void Flush();
+
     private:
+        struct Entry
+        {
+            std::atomic<uint64_t> seq;
+            LogType type;
+            char msg[MSG_SIZE];
+        };
+
+        void Push(LogType type, const char *fmt, va_list args);
+        bool Ready() const;
+        bool Print();
+        void Loop();
+        void Wake();
+
         bool enabled;
+        std::unique_ptr<Entry[]> ring;
+        std::atomic<uint64_t> head;
+        std::atomic<uint64_t> tail;
+        std::atomic<uint64_t> dropped;
+        std::atomic<bool> stop;
+        // the printer sleeps on the condition while the ring is empty, producers only lock to wake it.
+        std::atomic<bool> parked;
+        std::mutex park_mtx;
+        std::condition_variable park_cv;
+        std::once_flag started;
+        std::thread printer;
         static std::map<std::string, bool> bool_map;
     };
 
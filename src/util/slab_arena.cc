@@ -0,0 +1,179 @@
+#include "slab_arena.h"
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+
+namespace Echidna
+{
+    SlabArena::SlabArena(size_t usize)
+        // a multiple of the smallest block, so the tail of a slab is always carved into blocks to the end.
+        : slab_size(usize < ClassSize(CLASSES - 1) ? ClassSize(CLASSES - 1) : (usize + MIN_BLOCK - 1) / MIN_BLOCK * MIN_BLOCK),
+          cursor(nullptr),
+          left(0),
+          free_lists(CLASSES, nullptr),
+          in_use(0),
+          reserved(0) {}
+
+    SlabArena::~SlabArena()
+    {
+        for (auto &&slab : slabs)
+        {
+            free(slab);
+        }
+    }
+
+    char *SlabArena::Alloc(size_t len, uint32_t &cls)
+    {
+        cls = 0;
+        while (cls < CLASSES && ClassSize(cls) < len)
+        {
+            cls++;
+        }
+
+        if (cls == LARGE)
+        {
+            char *large = static_cast<char *>(malloc(len));
+            if (large)
+            {
+                in_use += len;
+                reserved += len;
+            }
+            return large;
+        }
+
+        size_t size = ClassSize(cls);
+        char *block = free_lists[cls];
+        if (block)
+        {
+            // a free block keeps the next free block of its class at its head.
+            memcpy(&free_lists[cls], block, sizeof(char *));
+            in_use += size;
+            return block;
+        }
+
+        if (left < size)
+        {
+            char *slab = static_cast<char *>(malloc(slab_size));
+            if (!slab)
+            {
+                return nullptr;
+            }
+            // the tail of the old slab is too small, give it to the free lists before moving on.
+            Retire();
+            slabs.push_back(slab);
+            cursor = slab;
+            left = slab_size;
+            reserved += slab_size;
+        }
+        block = cursor;
+        cursor += size;
+        left -= size;
+        in_use += size;
+        return block;
+    }
+
+    void SlabArena::Retire()
+    {
+        while (left >= MIN_BLOCK)
+        {
+            uint32_t tail = 0;
+            while (tail + 1 < CLASSES && ClassSize(tail + 1) <= left)
+            {
+                tail++;
+            }
+            memcpy(cursor, &free_lists[tail], sizeof(char *));
+            free_lists[tail] = cursor;
+            cursor += ClassSize(tail);
+            left -= ClassSize(tail);
+        }
+        cursor = nullptr;
+        left = 0;
+    }
+
+    size_t SlabArena::Trim()
+    {
+        Retire();
+        std::sort(slabs.begin(), slabs.end());
+        auto owner = [this](char *block) -> size_t
+        {
+            return std::upper_bound(slabs.begin(), slabs.end(), block) - slabs.begin() - 1;
+        };
+
+        // free bytes per slab, a slab is empty when they add up to its size.
+        std::vector<size_t> unused(slabs.size(), 0);
+        for (uint32_t cls = 0; cls < CLASSES; cls++)
+        {
+            char *block = free_lists[cls];
+            while (block)
+            {
+                unused[owner(block)] += ClassSize(cls);
+                memcpy(&block, block, sizeof(char *));
+            }
+        }
+        if (std::find(unused.begin(), unused.end(), slab_size) == unused.end())
+        {
+            return 0;
+        }
+
+        // unlink the blocks of the empty slabs, the others keep their order.
+        for (uint32_t cls = 0; cls < CLASSES; cls++)
+        {
+            char *prev = nullptr;
+            char *block = free_lists[cls];
+            while (block)
+            {
+                char *next;
+                memcpy(&next, block, sizeof(char *));
+                if (unused[owner(block)] != slab_size)
+                {
+                    prev = block;
+                }
+                else if (prev)
+                {
+                    memcpy(prev, &next, sizeof(char *));
+                }
+                else
+                {
+                    free_lists[cls] = next;
+                }
+                block = next;
+            }
+        }
+
+        size_t released = 0;
+        size_t kept = 0;
+        for (size_t i = 0; i < slabs.size(); i++)
+        {
+            if (unused[i] == slab_size)
+            {
+                free(slabs[i]);
+                released += slab_size;
+            }
+            else
+            {
+                slabs[kept++] = slabs[i];
+            }
+        }
+        slabs.resize(kept);
+        reserved -= released;
+        return released;
+    }
+
+    void SlabArena::Free(char *block, uint32_t cls, size_t len)
+    {
+        if (!block)
+        {
+            return;
+        }
+        if (cls == LARGE)
+        {
+            in_use -= len;
+            reserved -= len;
+            free(block);
+            return;
+        }
+        in_use -= ClassSize(cls);
+        memcpy(block, &free_lists[cls], sizeof(char *));
+        free_lists[cls] = block;
+    }
+}
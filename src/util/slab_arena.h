@@ -0,0 +1,79 @@
+#pragma once
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Echidna
+{
+    /**
+     * a slab allocator of power-of-two size classes, for many small blocks that come and go.
+     *
+     * Blocks are carved from large slabs and recycled through a free list per class, so allocating does not
+     * go to the heap in steady state. Blocks larger than the largest class are allocated directly. Slabs
+     * are only given back to the heap by @ref Trim(). It is not thread safe.
+     */
+    class SlabArena
+    {
+    public:
+        constexpr static uint32_t MIN_BLOCK = 32;
+        constexpr static uint32_t CLASSES = 12;
+        constexpr static uint32_t LARGE = CLASSES;
+
+        SlabArena(size_t slab_size = 256 * 1024);
+        SlabArena(const SlabArena &) = delete;
+        SlabArena &operator=(const SlabArena &) = delete;
+        ~SlabArena();
+
+        /**
+         * allocate a block of at least len bytes.
+         *
+         * @param cls
+         *      it returns the class of the block, that must be passed to @ref Free().
+         * @return the block, or nullptr if the heap is out of memory.
+         */
+        char *Alloc(size_t len, uint32_t &cls);
+
+        /**
+         * give back a block, len is the one passed to @ref Alloc().
+         */
+        void Free(char *block, uint32_t cls, size_t len);
+
+        /**
+         * give the slabs whose blocks are all free back to the heap. It walks every free block, so call it
+         * when much more is reserved than in use, not on every free.
+         *
+         * @return bytes given back.
+         */
+        size_t Trim();
+
+        /**
+         * the usable size of a block of the class.
+         */
+        static size_t ClassSize(uint32_t cls) { return static_cast<size_t>(MIN_BLOCK) << cls; }
+
+        /**
+         * bytes of blocks that are allocated and not freed.
+         */
+        size_t InUse() const { return in_use; }
+
+        /**
+         * bytes the arena holds from the heap, including free blocks.
+         */
+        size_t Reserved() const { return reserved; }
+
+        size_t SlabSize() const { return slab_size; }
+
+    private:
+        // give the unused tail of the newest slab to the free lists.
+        void Retire();
+
+        size_t slab_size;
+        std::vector<char *> slabs;
+        // the unused tail of the newest slab.
+        char *cursor;
+        size_t left;
+        std::vector<char *> free_lists;
+        size_t in_use;
+        size_t reserved;
+    };
+}
@@ -9,8 +9,8 @@ namespace Echidna
 
     unsigned int RandUint()
     {
-        std::random_device rd;
-        std::mt19937 gen(rd());
+        // seeding from random_device is a syscall, the engine is seeded once per thread.
+        static thread_local std::mt19937 gen(std::random_device{}());
         std::uniform_int_distribution<unsigned int> dis(0, std::numeric_limits<unsigned int>::max() - 1);
         return dis(gen);
     }
@@ -19,7 +19,7 @@ namespace Echidna
     {
         auto id = RandUint();
         mtx.lock();
-        while (id_set.find(id) != id_set.end())
+        while (id_set.find(id) != id_set.end() || Reserved(id))
         {
             id = RandUint();
         }
@@ -35,7 +35,7 @@ namespace Echidna
             return false;
         }
         mtx.lock();
-        if (id_set.find(id) != id_set.end())
+        if (id_set.find(id) != id_set.end() || Reserved(id))
         {
             mtx.unlock();
             return false;
@@ -48,5 +48,44 @@ namespace Echidna
         }
     }
 
+    uint32_t UniqueIdGen::GetIDs(uint32_t count)
+    {
+        constexpr uint32_t limit = std::numeric_limits<unsigned int>::max();
+        count = count ? count : 1;
+        std::lock_guard<std::mutex> lock(mtx);
+        while (true)
+        {
+            auto first = RandUint();
+            if (first > limit - count)
+            {
+                continue;
+            }
+            uint32_t last = first + count;
+            auto id = id_set.lower_bound(first);
+            if (id != id_set.end() && *id < last)
+            {
+                continue;
+            }
+            auto block = blocks.lower_bound(last);
+            if (block != blocks.begin() && (--block)->second > first)
+            {
+                continue;
+            }
+            blocks.emplace(first, last);
+            return first;
+        }
+    }
+
+    bool UniqueIdGen::Reserved(uint32_t id) const
+    {
+        // called with mtx held.
+        auto block = blocks.upper_bound(id);
+        if (block == blocks.begin())
+        {
+            return false;
+        }
+        return id < (--block)->second;
+    }
+
     UniqueIdGen IdGenerator;
 }
\ No newline at end of file
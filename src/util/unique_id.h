@@ -1,4 +1,5 @@
 #pragma once
+#include <map>
 #include <set>
 #include <stdint.h>
 namespace Echidna
@@ -9,8 +10,18 @@ namespace Echidna
         uint32_t GetID();
         bool SetID(unsigned int id);
 
+        /**
+         * reserve count consecutive ids at once, it returns the first one. The block costs one entry
+         * however large it is.
+         */
+        uint32_t GetIDs(uint32_t count);
+
     private:
+        bool Reserved(uint32_t id) const;
+
         std::set<uint32_t> id_set;
+        // reserved blocks, first id to one past the last.
+        std::map<uint32_t, uint32_t> blocks;
     };
     extern UniqueIdGen IdGenerator;
 }
\ No newline at end of file